@@ -0,0 +1,267 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "perfstatsd_binder"
+
+#include "binder_stats.h"
+#include <android-base/stringprintf.h>
+#include <unistd.h>
+#include <algorithm>
+#include "text_parser.h"
+
+using namespace android::pixel::perfstatsd;
+
+static constexpr const char *BINDER_STATS_PATHS[] = {
+    "/dev/binderfs/binder_logs/stats",
+    "/sys/kernel/debug/binder/stats",
+};
+
+static constexpr char FMT_BINDER[] =
+    "[BINDER: %lld.%03llds] out:%" PRIu64 " in:%" PRIu64 " pending:%u exhausted:%u\n";
+static constexpr char FMT_BINDER_TOP[] =
+    "[BINDER_TOP%zu] %5u %-16.*s out:%" PRIu64 " in:%" PRIu64 " pending:%u threads:%u/%u%s\n";
+
+static bool cDebug = false;
+
+static bool pidLess(const BinderProc &a, const BinderProc &b) {
+    return a.pid < b.pid;
+}
+
+// The comm of |pid| as a view into its cached identity
+static std::string_view procName(ProcSnapshot *snapshot, uint32_t pid) {
+    const ProcIdentity *identity = snapshot->getIdentity(pid);
+    return identity == nullptr ? "-" : std::string_view(identity->comm);
+}
+
+BinderStats::BinderStats(const sp<ProcSnapshot> &snapshot)
+    : mProcSnapshot(snapshot),
+      mDisabled(false),
+      mValid(false),
+      mTopCount(BINDER_TOP_DEFAULT),
+      mPath(nullptr) {
+    mLast = std::chrono::steady_clock::now();
+    for (const char *path : BINDER_STATS_PATHS) {
+        if (access(path, R_OK) == 0) {
+            mPath = path;
+            break;
+        }
+    }
+    if (mPath == nullptr)
+        LOG_TO(SYSTEM, WARNING) << "No binder stats available";
+}
+
+/*
+ * setOptions - BinderStats supports following options
+ *     binderstats.topcount : number of processes listed per interval
+ *     binderstats.disabled : 1 - to stop collecting; 0 - enabled
+ *     binderstats.debug : 1 - to enable debug log; 0 - disabled
+ */
+void BinderStats::setOptions(const std::string &key, const std::string &value) {
+    if (key == BINDERSTATS_TOPCOUNT || key == BINDERSTATS_DISABLED || key == BINDERSTATS_DEBUG) {
+        uint32_t val = 0;
+        if (!base::ParseUint(value, &val)) {
+            LOG_TO(SYSTEM, ERROR) << "Invalid value: " << value;
+            return;
+        }
+        if (key == BINDERSTATS_TOPCOUNT) {
+            mTopCount = val;
+            LOG_TO(SYSTEM, INFO) << "set top count " << mTopCount;
+        } else if (key == BINDERSTATS_DISABLED) {
+            mDisabled = (val != 0);
+            LOG_TO(SYSTEM, INFO) << "set disabled " << mDisabled;
+        } else {
+            cDebug = (val != 0);
+            LOG_TO(SYSTEM, INFO) << "set debug " << cDebug;
+        }
+    }
+}
+
+/*
+ * Parse the per process sections of the binder stats, e.g.
+ *   proc 1234
+ *   context binder
+ *     threads: 12
+ *     requested threads: 0+10/31
+ *     ready threads 3
+ *     ...
+ *     pending transactions: 0
+ *     BC_TRANSACTION: 5182
+ *     BC_TRANSACTION_SG: 96
+ *     BR_TRANSACTION: 21903
+ *     BR_SPAWN_LOOPER: 10
+ * A process has one section per binder context it uses.
+ */
+void BinderStats::parseStats(std::string_view text, std::vector<BinderProc> *out) {
+    out->clear();
+    BinderProc *proc = nullptr;
+    uint32_t started = 0, maxThreads = 0;  // of the current context
+    TextScanner scanner(text);
+    for (; !scanner.atEnd(); scanner.nextLine()) {
+        if (scanner.consume("proc ")) {
+            uint32_t pid;
+            if (!scanner.parseUint(&pid)) {
+                proc = nullptr;
+                continue;
+            }
+            out->push_back({pid, 0, 0, 0, 0, 0, 0, 0, false});
+            proc = &out->back();
+            continue;
+        }
+        // Counters before the first "proc" are the global ones
+        if (proc == nullptr)
+            continue;
+        scanner.skipSpaces();
+        uint64_t count;
+        // Scatter-gather calls are counted apart by the kernel
+        if (scanner.consume("BC_TRANSACTION:") || scanner.consume("BC_TRANSACTION_SG:")) {
+            if (scanner.parseUint(&count))
+                proc->outgoing += count;
+        } else if (scanner.consume("BR_TRANSACTION:") ||
+                   scanner.consume("BR_TRANSACTION_SEC_CTX:")) {
+            if (scanner.parseUint(&count))
+                proc->incoming += count;
+        } else if (scanner.consume("BR_SPAWN_LOOPER:")) {
+            if (scanner.parseUint(&count))
+                proc->spawned += count;
+        } else if (scanner.consume("pending transactions:")) {
+            uint32_t pending;
+            if (scanner.parseUint(&pending))
+                proc->pending += pending;
+        } else if (scanner.consume("requested threads:")) {
+            uint32_t requested;
+            if (scanner.parseUint(&requested) && scanner.skipPast('+') &&
+                scanner.parseUint(&started) && scanner.skipPast('/') &&
+                scanner.parseUint(&maxThreads)) {
+                proc->started += started;
+                proc->maxThreads += maxThreads;
+            }
+        } else if (scanner.consume("ready threads")) {
+            // Printed right after the requested threads of the same context
+            uint32_t ready;
+            if (scanner.parseUint(&ready)) {
+                proc->ready += ready;
+                if (maxThreads > 0 && ready == 0 && started >= maxThreads)
+                    proc->exhausted = true;
+            }
+            started = 0;
+            maxThreads = 0;
+        }
+    }
+    // Fold the contexts of one process together
+    std::sort(out->begin(), out->end(), pidLess);
+    auto last = out->begin();
+    for (auto it = out->begin(); it != out->end(); ++it) {
+        if (last != out->begin() && (last - 1)->pid == it->pid) {
+            BinderProc &p = *(last - 1);
+            p.outgoing += it->outgoing;
+            p.incoming += it->incoming;
+            p.spawned += it->spawned;
+            p.pending += it->pending;
+            p.ready += it->ready;
+            p.started += it->started;
+            p.maxThreads += it->maxThreads;
+            p.exhausted = p.exhausted || it->exhausted;
+        } else {
+            *last++ = *it;
+        }
+    }
+    out->erase(last, out->end());
+}
+
+bool BinderStats::readStats(void) {
+    if (mPath == nullptr || !readFileToBuffer(mPath, &mBuffer)) {
+        if (cDebug)
+            LOG_TO(SYSTEM, WARNING) << "Fail to read binder stats";
+        return false;
+    }
+    parseStats(mBuffer, &mCurrent);
+    return true;
+}
+
+void BinderStats::calcDiffs(void) {
+    mDiffs.clear();
+    auto prev = mPrevious.begin();
+    for (const BinderProc &curr : mCurrent) {
+        while (prev != mPrevious.end() && prev->pid < curr.pid) ++prev;
+        BinderProc diff = curr;
+        // Processes new in this interval count from zero
+        if (prev != mPrevious.end() && prev->pid == curr.pid) {
+            diff.outgoing -= std::min(prev->outgoing, curr.outgoing);
+            diff.incoming -= std::min(prev->incoming, curr.incoming);
+            diff.spawned -= std::min(prev->spawned, curr.spawned);
+        }
+        mDiffs.push_back(diff);
+    }
+}
+
+/* Dump binder activity (Sample Log)
+ *
+ * [BINDER: 10.001s] out:5230 in:5230 pending:3 exhausted:1
+ * [BINDER_TOP1]  1520 system_server    out:1200 in:3100 pending:2 threads:0/31 EXHAUSTED
+ * [BINDER_TOP2]   873 surfaceflinger   out:620 in:1480 pending:0 threads:2/4
+ */
+void BinderStats::refresh(void) {
+    if (mDisabled)
+        return;
+
+    std::chrono::system_clock::time_point now = std::chrono::system_clock::now();
+    std::chrono::steady_clock::time_point awake = std::chrono::steady_clock::now();
+    if (!readStats()) {
+        mValid = false;
+        return;
+    }
+    if (!mValid) {
+        mPrevious.swap(mCurrent);
+        mValid = true;
+        mLast = awake;
+        return;
+    }
+    calcDiffs();
+    mPrevious.swap(mCurrent);
+
+    uint64_t outgoing = 0, incoming = 0;
+    uint32_t pending = 0, exhausted = 0;
+    for (const BinderProc &d : mDiffs) {
+        outgoing += d.outgoing;
+        incoming += d.incoming;
+        pending += d.pending;
+        exhausted += d.exhausted ? 1 : 0;
+    }
+    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(awake - mLast);
+    std::string out = android::base::StringPrintf(FMT_BINDER, ms.count() / 1000, ms.count() % 1000,
+                                                  outgoing, incoming, pending, exhausted);
+    // Exhausted pools first, then the busiest processes
+    size_t count = std::min<size_t>(mTopCount, mDiffs.size());
+    std::partial_sort(mDiffs.begin(), mDiffs.begin() + count, mDiffs.end(),
+                      [](const BinderProc &a, const BinderProc &b) {
+                          if (a.exhausted != b.exhausted)
+                              return a.exhausted;
+                          return a.outgoing + a.incoming > b.outgoing + b.incoming;
+                      });
+    for (size_t i = 0; i < count; i++) {
+        const BinderProc &d = mDiffs[i];
+        if (!d.exhausted && d.outgoing + d.incoming == 0)
+            break;
+        std::string_view name = procName(mProcSnapshot.get(), d.pid);
+        out.append(android::base::StringPrintf(
+            FMT_BINDER_TOP, i + 1, d.pid, static_cast<int>(name.size()), name.data(), d.outgoing,
+            d.incoming, d.pending, d.ready, d.maxThreads, d.exhausted ? " EXHAUSTED" : ""));
+    }
+    mLast = awake;
+    if (cDebug)
+        LOG_TO(SYSTEM, INFO) << out;
+    append(now, out);
+}
@@ -0,0 +1,65 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "collector_registry.h"
+#include "binder_stats.h"
+#include "cpu_usage.h"
+#include "devfreq_stats.h"
+#include "disk_stats.h"
+#include "f2fs_stats.h"
+#include "io_usage.h"
+#include "mem_stats.h"
+#include "net_stats.h"
+#include "wakeup_stats.h"
+
+using namespace android::pixel::perfstatsd;
+
+const std::vector<CollectorInfo> &android::pixel::perfstatsd::getCollectorRegistry(void) {
+    static const std::vector<CollectorInfo> registry = {
+        {"cpu", CPU_USAGE_BUFFER_SIZE,
+         [](const CollectorContext &context) -> StatsType * {
+             return new CpuUsage(context.snapshot);
+         }},
+        {"io", IO_USAGE_BUFFER_SIZE,
+         [](const CollectorContext &context) -> StatsType * {
+             return new IoUsage(context.snapshot);
+         }},
+        {"binder", BINDER_STATS_BUFFER_SIZE,
+         [](const CollectorContext &context) -> StatsType * {
+             return new BinderStats(context.snapshot);
+         }},
+        {"devfreq", DEVFREQ_STATS_BUFFER_SIZE,
+         [](const CollectorContext &) -> StatsType * { return new DevfreqStats(); }},
+        {"disk", DISK_STATS_BUFFER_SIZE,
+         [](const CollectorContext &) -> StatsType * { return new DiskStats(); }},
+        {"mem", MEM_STATS_BUFFER_SIZE,
+         [](const CollectorContext &context) -> StatsType * {
+             return new MemStats(context.snapshot);
+         }},
+        {"net", NET_STATS_BUFFER_SIZE,
+         [](const CollectorContext &) -> StatsType * { return new NetStats(); }},
+        {"wakeup", WAKEUP_STATS_BUFFER_SIZE,
+         [](const CollectorContext &) -> StatsType * { return new WakeupStats(); }},
+        // After io, to see the top writers of the same tick; "io" is always an IoUsage.
+        // It is looked up when needed since it may be enabled after f2fs.
+        {"f2fs", F2FS_STATS_BUFFER_SIZE,
+         [](const CollectorContext &context) -> StatsType * {
+             auto find = context.find;
+             return new F2fsStats([find]() { return static_cast<IoUsage *>(find("io")); });
+         }},
+    };
+    return registry;
+}
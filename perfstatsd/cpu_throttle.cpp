@@ -0,0 +1,229 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "perfstatsd_cpu"
+
+#include "cpu_throttle.h"
+#include <android-base/file.h>
+#include <android-base/logging.h>
+#include <android-base/parseint.h>
+#include <android-base/stringprintf.h>
+#include <android-base/strings.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <algorithm>
+#include "text_parser.h"
+
+using namespace android::pixel::perfstatsd;
+
+static constexpr const char *CPUFREQ_DIR = "/sys/devices/system/cpu/cpufreq/";
+static constexpr const char *COOLING_DIR = "/sys/class/thermal/";
+static constexpr char FMT_CPU_CAP[] = " %s:%.1f%%,capped:%.1f%%";
+
+static android::base::unique_fd openNode(const std::string &path) {
+    return android::base::unique_fd(TEMP_FAILURE_RETRY(open(path.c_str(), O_RDONLY | O_CLOEXEC)));
+}
+
+CpuThrottle::CpuThrottle(void) {
+    discoverPolicies();
+    bindCoolingDevices();
+}
+
+bool CpuThrottle::readUint(int fd, uint64_t *value) {
+    return fd >= 0 && readFdToBuffer(fd, &mBuffer) && TextScanner(mBuffer).parseUint(value);
+}
+
+void CpuThrottle::discoverPolicies(void) {
+    DIR *dir = opendir(CPUFREQ_DIR);
+    if (dir == NULL) {
+        LOG_TO(SYSTEM, WARNING) << "Fail to open " << CPUFREQ_DIR;
+        return;
+    }
+    struct dirent *ent;
+    while ((ent = readdir(dir)) != NULL) {
+        std::string name = ent->d_name;
+        CpuPolicy policy;
+        if (!android::base::StartsWith(name, "policy") ||
+            !android::base::ParseUint(name.substr(strlen("policy")), &policy.cpu)) {
+            continue;
+        }
+        std::string base = CPUFREQ_DIR + name + "/";
+        android::base::unique_fd maxFd = openNode(base + "cpuinfo_max_freq");
+        policy.capFd = openNode(base + "scaling_max_freq");
+        if (!readUint(maxFd, &policy.maxFreq) || policy.maxFreq == 0 || policy.capFd < 0) {
+            LOG_TO(SYSTEM, WARNING) << "No frequency limits in " << base;
+            continue;
+        }
+        policy.name = name;
+        policy.capValid = false;
+        policy.cdevValid = false;
+        std::string freqs;
+        if (android::base::ReadFileToString(base + "scaling_available_frequencies", &freqs)) {
+            for (const auto &freq : android::base::Split(android::base::Trim(freqs), " ")) {
+                uint64_t value;
+                if (android::base::ParseUint(freq, &value))
+                    policy.freqs.push_back(value);
+            }
+            std::sort(policy.freqs.begin(), policy.freqs.end(), std::greater<uint64_t>());
+            policy.freqs.erase(std::unique(policy.freqs.begin(), policy.freqs.end()),
+                               policy.freqs.end());
+        }
+        mPolicies.push_back(std::move(policy));
+    }
+    closedir(dir);
+    std::sort(mPolicies.begin(), mPolicies.end(),
+              [](const CpuPolicy &a, const CpuPolicy &b) { return a.cpu < b.cpu; });
+}
+
+/*
+ * cpufreq cooling devices are typed "cpufreq-cpu<N>" by the first cpu of the
+ * policy, or "thermal-cpufreq-<K>" by registration order on older kernels.
+ */
+void CpuThrottle::bindCoolingDevices(void) {
+    DIR *dir = opendir(COOLING_DIR);
+    if (dir == NULL) {
+        return;
+    }
+    struct dirent *ent;
+    while ((ent = readdir(dir)) != NULL) {
+        std::string name = ent->d_name;
+        if (!android::base::StartsWith(name, "cooling_device")) {
+            continue;
+        }
+        std::string base = COOLING_DIR + name + "/";
+        std::string type;
+        if (!android::base::ReadFileToString(base + "type", &type)) {
+            continue;
+        }
+        type = android::base::Trim(type);
+        CpuPolicy *policy = nullptr;
+        uint32_t id;
+        if (android::base::StartsWith(type, "cpufreq-cpu") &&
+            android::base::ParseUint(type.substr(strlen("cpufreq-cpu")), &id)) {
+            for (auto &p : mPolicies) {
+                if (p.cpu == id)
+                    policy = &p;
+            }
+        } else if (android::base::StartsWith(type, "thermal-cpufreq-") &&
+                   android::base::ParseUint(type.substr(strlen("thermal-cpufreq-")), &id) &&
+                   id < mPolicies.size()) {
+            policy = &mPolicies[id];
+        }
+        if (policy == nullptr || policy->freqs.empty()) {
+            continue;
+        }
+        // Needs CONFIG_THERMAL_STATISTICS
+        policy->cdevFd = openNode(base + "stats/time_in_state_ms");
+        if (policy->cdevFd >= 0) {
+            LOG_TO(SYSTEM, INFO) << "Throttling of " << policy->name << " from " << name;
+        }
+    }
+    closedir(dir);
+}
+
+/*
+ * Parse stats/time_in_state_ms of a cooling device, e.g.
+ *   state0 812345
+ *   state1 1200
+ *   state2 0
+ */
+bool CpuThrottle::parseStates(std::string_view text, CpuPolicy *policy) {
+    std::fill(policy->currStateMs.begin(), policy->currStateMs.end(), 0);
+    TextScanner scanner(text);
+    for (; !scanner.atEnd(); scanner.nextLine()) {
+        size_t state;
+        uint64_t ms;
+        if (!scanner.consume("state") || !scanner.parseUint(&state) || !scanner.parseUint(&ms)) {
+            continue;
+        }
+        if (state >= policy->currStateMs.size()) {
+            policy->currStateMs.resize(state + 1, 0);
+            policy->cdevValid = false;
+        }
+        policy->currStateMs[state] = ms;
+    }
+    return !policy->currStateMs.empty();
+}
+
+bool CpuThrottle::readStates(CpuPolicy *policy) {
+    return readFdToBuffer(policy->cdevFd, &mBuffer) && parseStates(mBuffer, policy);
+}
+
+/* Append the time weighted cap of each policy, in % of cpuinfo_max_freq, and
+ * the share of the interval spent below it (Sample Log)
+ *
+ * [CPU_CAP] policy0:100.0%,capped:0.0% policy4:81.2%,capped:35.0% policy7:52.3%,capped:100.0%
+ */
+void CpuThrottle::sample(std::string *out) {
+    std::string line;
+    for (CpuPolicy &policy : mPolicies) {
+        uint64_t cap;
+        if (!readUint(policy.capFd, &cap)) {
+            policy.capValid = false;
+            continue;
+        }
+        float capRatio = 0.0f;
+        float cappedRatio = 0.0f;
+        bool valid = false;
+        if (policy.cdevFd >= 0 && readStates(&policy)) {
+            // Writing stats/reset or re-registering the device zeroes the
+            // residency; start over from the new counters and use the samples
+            // of scaling_max_freq for this interval
+            for (size_t s = 0; s < policy.currStateMs.size() && policy.cdevValid; s++) {
+                policy.cdevValid = policy.currStateMs[s] >= policy.prevStateMs[s];
+            }
+            if (policy.cdevValid) {
+                // scaling_max_freq also holds limits other than this cooling
+                // device, e.g. user space ones. Both samples are at or below
+                // such a limit, so the higher one bounds it over the interval.
+                uint64_t limit = policy.capValid ? std::max(policy.prevCap, cap) : cap;
+                limit = std::min(limit, policy.maxFreq);
+                uint64_t total = 0, capped = 0;
+                double weighted = 0;
+                for (size_t s = 0; s < policy.currStateMs.size(); s++) {
+                    uint64_t ms = policy.currStateMs[s] - policy.prevStateMs[s];
+                    uint64_t freq = policy.freqs[std::min(s, policy.freqs.size() - 1)];
+                    freq = std::min(freq, limit);
+                    total += ms;
+                    weighted += static_cast<double>(freq) * ms;
+                    if (freq < policy.maxFreq)
+                        capped += ms;
+                }
+                if (total > 0) {
+                    capRatio = weighted * 100.0 / total / policy.maxFreq;
+                    cappedRatio = capped * 100.0f / total;
+                    valid = true;
+                }
+            }
+            policy.prevStateMs = policy.currStateMs;
+            policy.cdevValid = true;
+        }
+        if (!valid && policy.capValid) {
+            capRatio = (policy.prevCap + cap) * 50.0f / policy.maxFreq;
+            cappedRatio = ((policy.prevCap < policy.maxFreq) + (cap < policy.maxFreq)) * 50.0f;
+            valid = true;
+        }
+        policy.prevCap = cap;
+        policy.capValid = true;
+        if (valid) {
+            line.append(android::base::StringPrintf(FMT_CPU_CAP, policy.name.c_str(), capRatio,
+                                                    cappedRatio));
+        }
+    }
+    if (!line.empty()) {
+        out->append("[CPU_CAP]" + line + "\n");
+    }
+}
@@ -19,16 +19,19 @@
 #include "cpu_usage.h"
 #include <android-base/stringprintf.h>
 #include <android-base/strings.h>
+#include "text_parser.h"
 
 using namespace android::pixel::perfstatsd;
 
 static bool cDebug = false;
 static constexpr char FMT_CPU_TOTAL[] =
     "[CPU: %lld.%03llds][T:%.2f%%,U:%.2f%%,S:%.2f%%,IO:%.2f%%]";
+static constexpr char FMT_CPU_ANOMALY[] = "[CPU_ANOMALY] baseline %.2f%% +/- %.2f%%\n";
 static constexpr char TOP_HEADER[] = "[CPU_TOP]  PID, PROCESS_NAME, USR_TIME, SYS_TIME\n";
-static constexpr char FMT_TOP_PROFILE[] = "%6.2f%%   %5d %s %" PRIu64 " %" PRIu64 "\n";
+static constexpr char FMT_TOP_PROFILE[] = "%6.2f%%   %5d %.*s %" PRIu64 " %" PRIu64 "\n";
 
-CpuUsage::CpuUsage(void) {
+CpuUsage::CpuUsage(const sp<ProcSnapshot> &snapshot)
+    : mProcSnapshot(snapshot), mBaseline(CPU_ANOMALY_MIN_DEVIATION) {
     std::string procstat;
     if (android::base::ReadFileToString("/proc/stat", &procstat)) {
         std::istringstream stream(procstat);
@@ -36,19 +39,37 @@ CpuUsage::CpuUsage(void) {
         while (getline(stream, line)) {
             std::vector<std::string> fields = android::base::Split(line, " ");
             if (fields[0].find("cpu") != std::string::npos && fields[0] != "cpu") {
-                CpuData data;
+                CpuData data = {};
                 mPrevCoresUsage.push_back(data);
             }
         }
     }
     mCores = mPrevCoresUsage.size();
+    mPrevUsage = {};
+    std::vector<std::string> metrics = {"total", "user", "sys", "io"};
+    for (uint32_t c = 0; c < mCores; c++) {
+        metrics.push_back("cpu" + std::to_string(c));
+    }
+    mMetrics.assign(metrics.size(), 0.0f);
+    setMetricNames(metrics);
+    // Usage is recorded in 1/100 %
+    mTotalHistogram = addHistogram("total", "%", 100.0);
+    mCoreHistograms = mTotalHistogram + 1;
+    for (uint32_t c = 0; c < mCores; c++) {
+        addHistogram("cpu" + std::to_string(c), "%", 100.0);
+    }
     mProfileThreshold = CPU_USAGE_PROFILE_THRESHOLD;
     mTopcount = TOP_PROCESS_COUNT;
+    mScanPids = 0;
+    mScanUs = 0;
+    mScanCursor = 0;
+    mClkTck = sysconf(_SC_CLK_TCK);
 }
 
 void CpuUsage::setOptions(const std::string &key, const std::string &value) {
     if (key == PROCPROF_THRESHOLD || key == CPU_DISABLED || key == CPU_DEBUG ||
-        key == CPU_TOPCOUNT) {
+        key == CPU_TOPCOUNT || key == CPU_ANOMALY_SIGMA || key == CPU_SCAN_PIDS ||
+        key == CPU_SCAN_US || key == CPU_THROTTLE) {
         uint32_t val = 0;
         if (!base::ParseUint(value, &val)) {
             LOG_TO(SYSTEM, ERROR) << "Invalid value: " << value;
@@ -67,91 +88,152 @@ void CpuUsage::setOptions(const std::string &key, const std::string &value) {
         } else if (key == CPU_TOPCOUNT) {
             mTopcount = val;
             LOG_TO(SYSTEM, INFO) << "set top count " << mTopcount;
+        } else if (key == CPU_ANOMALY_SIGMA) {
+            mBaseline.setSigma(val);
+            LOG_TO(SYSTEM, INFO) << "set anomaly sigma " << val;
+        } else if (key == CPU_SCAN_PIDS) {
+            mScanPids = val;
+            LOG_TO(SYSTEM, INFO) << "set scan budget " << mScanPids << " pids";
+        } else if (key == CPU_SCAN_US) {
+            mScanUs = val;
+            LOG_TO(SYSTEM, INFO) << "set scan budget " << mScanUs << " us";
+        } else if (key == CPU_THROTTLE) {
+            if (val == 0) {
+                mThrottle.reset();
+            } else if (mThrottle == nullptr) {
+                mThrottle = std::make_unique<CpuThrottle>();
+            }
+            LOG_TO(SYSTEM, INFO) << "set throttle " << (mThrottle != nullptr);
         }
     }
 }
 
-void CpuUsage::profileProcess(std::string *out) {
-    // Read cpu usage per process and find the top ones
-    DIR *dir;
-    struct dirent *ent;
-    std::unordered_map<uint32_t, ProcData> procUsage;
-    std::priority_queue<ProcData, std::vector<ProcData>, ProcdataCompare> procList;
-    if ((dir = opendir("/proc/")) != NULL) {
-        while ((ent = readdir(dir)) != NULL) {
-            if (ent->d_type == DT_DIR) {
-                std::string pidStr = ent->d_name;
-                std::string::const_iterator it = pidStr.begin();
-                while (it != pidStr.end() && isdigit(*it)) ++it;
-                if (!pidStr.empty() && it == pidStr.end()) {
-                    std::string pidStat;
-                    if (android::base::ReadFileToString("/proc/" + pidStr + "/stat", &pidStat)) {
-                        std::vector<std::string> fields = android::base::Split(pidStat, " ");
-                        uint32_t pid = 0;
-                        uint64_t utime = 0;
-                        uint64_t stime = 0;
-                        uint64_t cutime = 0;
-                        uint64_t cstime = 0;
+// Read the usage of |pid| and rank it by its rate since its own last read
+void CpuUsage::sampleProcess(
+    uint32_t pid, std::chrono::steady_clock::time_point now,
+    std::priority_queue<ProcData, std::vector<ProcData>, ProcdataCompare> *procList) {
+    const ProcIdentity *identity = mProcSnapshot->getIdentity(pid);
+    const std::string *pidStat = mProcSnapshot->getStat(pid);
+    if (identity == nullptr || pidStat == nullptr) {
+        return;
+    }
+    uint64_t utime = 0;
+    uint64_t stime = 0;
+    uint64_t cutime = 0;
+    uint64_t cstime = 0;
 
-                        if (!base::ParseUint(fields[0], &pid) ||
-                            !base::ParseUint(fields[13], &utime) ||
-                            !base::ParseUint(fields[14], &stime) ||
-                            !base::ParseUint(fields[15], &cutime) ||
-                            !base::ParseUint(fields[16], &cstime)) {
-                            LOG_TO(SYSTEM, ERROR) << "Invalid proc data\n" << pidStat;
-                            continue;
-                        }
-                        std::string proc = fields[1];
-                        std::string name =
-                            proc.length() > 2 ? proc.substr(1, proc.length() - 2) : "";
-                        uint64_t user = utime + cutime;
-                        uint64_t system = stime + cstime;
-                        uint64_t totalUsage = user + system;
+    // utime is field 14, counted after the comm that may contain spaces
+    size_t close = pidStat->rfind(')');
+    TextScanner scanner(std::string_view(*pidStat).substr(close + 1));
+    bool valid = true;
+    for (int i = 3; i < 14 && valid; i++) valid = scanner.skipToken();
+    if (!valid || !scanner.parseUint(&utime) || !scanner.parseUint(&stime) ||
+        !scanner.parseUint(&cutime) || !scanner.parseUint(&cstime)) {
+        LOG_TO(SYSTEM, ERROR) << "Invalid proc data\n" << *pidStat;
+        return;
+    }
+    uint64_t user = utime + cutime;
+    uint64_t system = stime + cstime;
+    uint64_t totalUsage = user + system;
 
-                        uint64_t diffUser = user - mPrevProcdata[pid].user;
-                        uint64_t diffSystem = system - mPrevProcdata[pid].system;
-                        uint64_t diffUsage = totalUsage - mPrevProcdata[pid].usage;
+    auto prev = mPrevProcdata.find(pid);
+    // A reused pid starts over
+    bool hasPrev = prev != mPrevProcdata.end() && prev->second.starttime == identity->starttime;
+    ProcCounters last;
+    if (hasPrev) {
+        last = prev->second;
+    }
+    ProcCounters &ldata = mPrevProcdata[pid];
+    ldata.starttime = identity->starttime;
+    ldata.user = user;
+    ldata.system = system;
+    ldata.usage = totalUsage;
+    ldata.time = now;
+    // The first read of a process is only a reference point
+    if (!hasPrev) {
+        return;
+    }
 
-                        ProcData ldata;
-                        ldata.user = user;
-                        ldata.system = system;
-                        ldata.usage = totalUsage;
-                        procUsage[pid] = ldata;
+    // Pids are read at different ticks, so each delta is over its own elapsed time
+    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(now - last.time).count();
+    float cpuTicks = ms * mClkTck * mCores / 1000.0f;
+    uint64_t diffUsage = totalUsage - last.usage;
+    float usageRatio = cpuTicks > 0 ? diffUsage * 100.0f / cpuTicks : 0.0f;
+    if (cDebug && usageRatio > 100) {
+        LOG_TO(SYSTEM, INFO) << "pid: " << pid << " , ratio: " << usageRatio
+                             << " , prev usage: " << last.usage << " , cur usage: " << totalUsage
+                             << " , elapsed: " << ms << " ms";
+    }
 
-                        float usageRatio = (float)(diffUsage * 100.0 / mDiffCpu);
-                        if (cDebug && usageRatio > 100) {
-                            LOG_TO(SYSTEM, INFO) << "pid: " << pid << " , ratio: " << usageRatio
-                                                 << " , prev usage: " << mPrevProcdata[pid].usage
-                                                 << " , cur usage: " << totalUsage
-                                                 << " , total cpu diff: " << mDiffCpu;
-                        }
+    ProcData data;
+    data.pid = pid;
+    data.name = identity->comm;
+    data.usageRatio = usageRatio;
+    data.user = user - last.user;
+    data.system = system - last.system;
+    procList->push(data);
+}
 
-                        ProcData data;
-                        data.pid = pid;
-                        data.name = name;
-                        data.usageRatio = usageRatio;
-                        data.user = diffUser;
-                        data.system = diffSystem;
-                        procList.push(data);
-                    }
-                }
-            }
-        }
-        mPrevProcdata = std::move(procUsage);
-        out->append(TOP_HEADER);
-        for (uint32_t count = 0; !procList.empty() && count < mTopcount; count++) {
-            ProcData data = procList.top();
-            out->append(android::base::StringPrintf(FMT_TOP_PROFILE, data.usageRatio, data.pid,
-                                                    data.name.c_str(), data.user, data.system));
-            procList.pop();
-        }
-        closedir(dir);
-    } else {
-        LOG_TO(SYSTEM, ERROR) << "Fail to open /proc/";
+void CpuUsage::profileProcess(std::string *out) {
+    // Read cpu usage per process and find the top ones
+    std::priority_queue<ProcData, std::vector<ProcData>, ProcdataCompare> procList;
+    const std::vector<uint32_t> &pids = mProcSnapshot->getPids();
+    auto start = std::chrono::steady_clock::now();
+
+    // Forget processes that exited
+    for (auto it = mPrevProcdata.begin(); it != mPrevProcdata.end();) {
+        if (!std::binary_search(pids.begin(), pids.end(), it->first))
+            it = mPrevProcdata.erase(it);
+        else
+            ++it;
+    }
+    // The last top consumers are read every time
+    for (uint32_t pid : mHotPids) {
+        if (std::binary_search(pids.begin(), pids.end(), pid))
+            sampleProcess(pid, start, &procList);
+    }
+    // Then as many others as the budget allows, round robin over the pid space.
+    // The budget covers this scan alone and always lets one pid through, so the
+    // cursor moves even when the hot pids took all of it.
+    auto scanStart = std::chrono::steady_clock::now();
+    size_t first = std::upper_bound(pids.begin(), pids.end(), mScanCursor) - pids.begin();
+    uint32_t scanned = 0;
+    for (size_t i = 0; i < pids.size(); i++) {
+        if (mScanPids > 0 && scanned >= mScanPids)
+            break;
+        if (mScanUs > 0 && scanned > 0 &&
+            std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - scanStart)
+                    .count() >= mScanUs)
+            break;
+        uint32_t pid = pids[(first + i) % pids.size()];
+        mScanCursor = pid;
+        if (std::find(mHotPids.begin(), mHotPids.end(), pid) != mHotPids.end())
+            continue;
+        sampleProcess(pid, start, &procList);
+        scanned++;
+    }
+    if (cDebug) {
+        LOG_TO(SYSTEM, INFO) << "profiled " << scanned << " of " << pids.size() << " pids in "
+                             << std::chrono::duration_cast<std::chrono::microseconds>(
+                                    std::chrono::steady_clock::now() - start)
+                                    .count()
+                             << " us";
+    }
+
+    mHotPids.clear();
+    out->append(TOP_HEADER);
+    for (uint32_t count = 0; !procList.empty() && count < mTopcount; count++) {
+        ProcData data = procList.top();
+        out->append(android::base::StringPrintf(FMT_TOP_PROFILE, data.usageRatio, data.pid,
+                                                static_cast<int>(data.name.size()),
+                                                data.name.data(), data.user, data.system));
+        mHotPids.push_back(data.pid);
+        procList.pop();
     }
 }
 
-void CpuUsage::getOverallUsage(std::chrono::system_clock::time_point &now, std::string *out) {
+void CpuUsage::getOverallUsage(std::chrono::steady_clock::time_point &awake, std::string *out) {
     mDiffCpu = 0;
     mTotalRatio = 0.0f;
     std::string procStat;
@@ -205,6 +287,10 @@ void CpuUsage::getOverallUsage(std::chrono::system_clock::time_point &now, std::
                     float userRatio = (float)(diffUser * 100.0 / mDiffCpu);
                     float sysRatio = (float)(diffSys * 100.0 / mDiffCpu);
                     float ioRatio = (float)(diffIo * 100.0 / mDiffCpu);
+                    mMetrics[0] = mTotalRatio;
+                    mMetrics[1] = userRatio;
+                    mMetrics[2] = sysRatio;
+                    mMetrics[3] = ioRatio;
 
                     if (cDebug) {
                         LOG_TO(SYSTEM, INFO)
@@ -219,7 +305,7 @@ void CpuUsage::getOverallUsage(std::chrono::system_clock::time_point &now, std::
                     mPrevUsage.sysUsage = system;
                     mPrevUsage.ioUsage = iowait;
 
-                    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(now - mLast);
+                    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(awake - mLast);
                     out->append(android::base::StringPrintf(FMT_CPU_TOTAL, ms.count() / 1000,
                                                             ms.count() % 1000, mTotalRatio,
                                                             userRatio, sysRatio, ioRatio));
@@ -239,6 +325,8 @@ void CpuUsage::getOverallUsage(std::chrono::system_clock::time_point &now, std::
                             << " , difftotalcpu: " << mDiffCpu << " , ratio: " << coreTotalRatio;
                     }
                     mPrevCoresUsage[c].cpuUsage = cpuUsage;
+                    if (c < mCores)
+                        mMetrics[4 + c] = coreTotalRatio;
 
                     char buf[64];
                     sprintf(buf, "%.2f%%]", coreTotalRatio);
@@ -258,24 +346,52 @@ void CpuUsage::refresh(void) {
 
     std::string out;
     std::chrono::system_clock::time_point now = std::chrono::system_clock::now();
+    std::chrono::steady_clock::time_point awake = std::chrono::steady_clock::now();
+    mTicks++;
 
-    getOverallUsage(now, &out);
+    getOverallUsage(awake, &out);
+    if (mThrottle != nullptr) {
+        mThrottle->sample(&out);
+    }
+    if (mDiffCpu > 0) {
+        appendMetrics(now, mMetrics.data());
+        record(mTotalHistogram, mMetrics[0] * 100);
+        for (uint32_t c = 0; c < mCores; c++) {
+            record(mCoreHistograms + c, mMetrics[4 + c] * 100);
+        }
+    }
 
-    if (mTotalRatio >= mProfileThreshold) {
-        if (cDebug)
-            LOG_TO(SYSTEM, INFO) << "Total CPU usage over " << mProfileThreshold << "%";
+    // Profile processes when usage stands out from its recent baseline; the
+    // fixed threshold applies while the baseline warms up or is disabled.
+    bool profile;
+    if (mBaseline.active()) {
+        float mean = mBaseline.mean();
+        float stddev = mBaseline.stddev();
+        profile = mDiffCpu > 0 && mBaseline.update(mTotalRatio);
+        if (profile)
+            out.append(android::base::StringPrintf(FMT_CPU_ANOMALY, mean, stddev));
+    } else {
+        if (mDiffCpu > 0)
+            mBaseline.update(mTotalRatio);
+        profile = mTotalRatio >= mProfileThreshold;
+    }
+    // Process deltas only explain this interval when the processes were also
+    // read in the previous one. An anomaly is usually a single interval, so
+    // while the baseline is active they are read on every refresh; with the
+    // fixed threshold, top processes come out once flagged twice in a row.
+    if (profile || mBaseline.active()) {
+        if (cDebug && profile)
+            LOG_TO(SYSTEM, INFO) << "Total CPU usage " << mTotalRatio << "% needs profiling";
+        bool fresh = mProfiledTick + 1 == mTicks;
         std::string profileResult;
         profileProcess(&profileResult);
-        if (mProfileProcess) {
-            // Dump top processes once met threshold continuously at least twice.
+        mProfiledTick = mTicks;
+        if (profile && fresh)
             out.append(profileResult);
-        } else
-            mProfileProcess = true;
-    } else
-        mProfileProcess = false;
+    }
 
     append(now, out);
-    mLast = now;
+    mLast = awake;
     if (cDebug) {
         auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
             std::chrono::system_clock::now() - now);
@@ -0,0 +1,202 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "perfstatsd_devfreq"
+
+#include "devfreq_stats.h"
+#include <android-base/stringprintf.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <algorithm>
+#include "text_parser.h"
+
+using namespace android::pixel::perfstatsd;
+
+static constexpr const char *DEVFREQ_CLASS_DIR = "/sys/class/devfreq/";
+static constexpr char FMT_DEVFREQ[] = "[DEVFREQ %s: %lld.%03llds] avg:%" PRIu64 "MHz";
+static constexpr char FMT_DEVFREQ_RESIDENCY[] = " %" PRIu64 "MHz:%.1f%%";
+
+static bool cDebug = false;
+
+DevfreqStats::DevfreqStats(void) : mDisabled(false) {
+    mLast = std::chrono::steady_clock::now();
+    discoverDevices();
+}
+
+void DevfreqStats::discoverDevices(void) {
+    DIR *dir = opendir(DEVFREQ_CLASS_DIR);
+    if (dir == NULL) {
+        LOG_TO(SYSTEM, WARNING) << "Fail to open " << DEVFREQ_CLASS_DIR;
+        return;
+    }
+    struct dirent *ent;
+    while ((ent = readdir(dir)) != NULL) {
+        std::string name = ent->d_name;
+        if (name == "." || name == "..") {
+            continue;
+        }
+        std::string path = DEVFREQ_CLASS_DIR + name + "/trans_stat";
+        DevfreqDevice dev;
+        dev.fd.reset(TEMP_FAILURE_RETRY(open(path.c_str(), O_RDONLY | O_CLOEXEC)));
+        if (dev.fd < 0) {
+            LOG_TO(SYSTEM, WARNING) << "Fail to open " << path;
+            continue;
+        }
+        dev.name = name;
+        dev.valid = false;
+        mDevices.push_back(std::move(dev));
+    }
+    closedir(dir);
+    std::sort(mDevices.begin(), mDevices.end(),
+              [](const DevfreqDevice &a, const DevfreqDevice &b) { return a.name < b.name; });
+}
+
+/*
+ * setOptions - DevfreqStats supports following options
+ *     devfreqstats.disabled : 1 - to stop collecting; 0 - enabled
+ *     devfreqstats.debug : 1 - to enable debug log; 0 - disabled
+ */
+void DevfreqStats::setOptions(const std::string &key, const std::string &value) {
+    if (key == DEVFREQSTATS_DISABLED || key == DEVFREQSTATS_DEBUG) {
+        uint32_t val = 0;
+        if (!base::ParseUint(value, &val)) {
+            LOG_TO(SYSTEM, ERROR) << "Invalid value: " << value;
+            return;
+        }
+        if (key == DEVFREQSTATS_DISABLED) {
+            mDisabled = (val != 0);
+            LOG_TO(SYSTEM, INFO) << "set disabled " << mDisabled;
+        } else {
+            cDebug = (val != 0);
+            LOG_TO(SYSTEM, INFO) << "set debug " << cDebug;
+        }
+    }
+}
+
+/*
+ * Parse trans_stat into dev->currMs, e.g.
+ *      From  :   To
+ *            : 421000000 546000000 676000000   time(ms)
+ * * 421000000:         0        12         3     81320
+ *   546000000:        10         0         4     10240
+ *   676000000:         5         2         0      2210
+ * Total transition : 36
+ * The current frequency is marked by '*'; the last column is the residency.
+ */
+bool DevfreqStats::parseTransStat(std::string_view text, DevfreqDevice *dev) {
+    size_t rows = 0;
+    bool changed = false;
+    TextScanner scanner(text);
+    for (; !scanner.atEnd(); scanner.nextLine()) {
+        scanner.skipSpaces();
+        scanner.consume("*");
+        uint64_t freq, value, time = 0;
+        // Header and total lines don't start with a frequency
+        if (!scanner.parseUint(&freq) || !scanner.skipPast(':')) {
+            continue;
+        }
+        while (scanner.parseUint(&value)) time = value;
+        if (rows < dev->freqs.size()) {
+            changed |= dev->freqs[rows] != freq;
+            dev->freqs[rows] = freq;
+            dev->currMs[rows] = time;
+        } else {
+            changed = true;
+            dev->freqs.push_back(freq);
+            dev->currMs.push_back(time);
+        }
+        rows++;
+    }
+    if (rows != dev->freqs.size()) {
+        changed = true;
+        dev->freqs.resize(rows);
+        dev->currMs.resize(rows);
+    }
+    // A new frequency table can't be diffed against the old one
+    if (changed) {
+        dev->prevMs.assign(rows, 0);
+        dev->valid = false;
+    }
+    return rows > 0;
+}
+
+bool DevfreqStats::readTransStat(DevfreqDevice *dev) {
+    if (!readFdToBuffer(dev->fd, &mBuffer)) {
+        if (cDebug)
+            PLOG_TO(SYSTEM, WARNING) << "Fail to read trans_stat of " << dev->name;
+        return false;
+    }
+    return parseTransStat(mBuffer, dev);
+}
+
+/* Dump devfreq residency, frequencies not visited in the interval are left out (Sample Log)
+ *
+ * [DEVFREQ 17000010.devfreq_mif: 10.001s] avg:892MHz 421MHz:61.2% 1014MHz:20.4% 2730MHz:18.4%
+ */
+void DevfreqStats::refresh(void) {
+    if (mDisabled)
+        return;
+
+    std::chrono::system_clock::time_point now = std::chrono::system_clock::now();
+    std::chrono::steady_clock::time_point awake = std::chrono::steady_clock::now();
+    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(awake - mLast);
+    std::string out;
+    for (DevfreqDevice &dev : mDevices) {
+        if (!readTransStat(&dev)) {
+            dev.valid = false;
+            continue;
+        }
+        // A write to trans_stat resets it; start over from the new counters
+        if (dev.valid) {
+            for (size_t i = 0; i < dev.freqs.size() && dev.valid; i++) {
+                dev.valid = dev.currMs[i] >= dev.prevMs[i];
+            }
+            if (!dev.valid && cDebug)
+                LOG_TO(SYSTEM, INFO) << dev.name << ": trans_stat was reset";
+        }
+        if (dev.valid) {
+            uint64_t total = 0;
+            double weighted = 0;
+            for (size_t i = 0; i < dev.freqs.size(); i++) {
+                uint64_t diff = dev.currMs[i] - dev.prevMs[i];
+                total += diff;
+                weighted += static_cast<double>(dev.freqs[i]) * diff;
+            }
+            if (total > 0) {
+                out.append(android::base::StringPrintf(
+                    FMT_DEVFREQ, dev.name.c_str(), ms.count() / 1000, ms.count() % 1000,
+                    static_cast<uint64_t>(weighted / total / 1000000)));
+                for (size_t i = 0; i < dev.freqs.size(); i++) {
+                    uint64_t diff = dev.currMs[i] - dev.prevMs[i];
+                    if (diff == 0)
+                        continue;
+                    out.append(android::base::StringPrintf(FMT_DEVFREQ_RESIDENCY,
+                                                           dev.freqs[i] / 1000000,
+                                                           diff * 100.0f / total));
+                }
+                out.append("\n");
+            }
+        }
+        dev.prevMs.swap(dev.currMs);
+        dev.valid = true;
+    }
+    mLast = awake;
+    if (out.empty())
+        return;
+    if (cDebug)
+        LOG_TO(SYSTEM, INFO) << out;
+    append(now, out);
+}
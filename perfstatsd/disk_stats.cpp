@@ -0,0 +1,173 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "perfstatsd_disk"
+
+#include "disk_stats.h"
+#include <android-base/stringprintf.h>
+#include <android-base/strings.h>
+#include <fcntl.h>
+#include "text_parser.h"
+
+using namespace android::pixel::perfstatsd;
+
+static constexpr uint64_t SECTOR_SIZE = 512;
+static constexpr char FMT_DISK[] =
+    "[DISK %s: %lld.%03llds] R:%.1fio/s,%.1fKB/s,%.2fms W:%.1fio/s,%.1fKB/s,%.2fms "
+    "D:%.1fio/s Q:%.2f busy:%.2f%%\n";
+
+static bool cDebug = false;
+
+DiskStats::DiskStats(void) : mDisabled(false) {
+    mLast = std::chrono::steady_clock::now();
+    setDevices(DISK_STATS_DEFAULT_DEVICES);
+}
+
+void DiskStats::setDevices(const std::string &devices) {
+    std::vector<BlockDevice> list;
+    for (const auto &name : android::base::Split(devices, ",")) {
+        if (name.empty()) {
+            continue;
+        }
+        BlockDevice dev;
+        dev.name = name;
+        dev.valid = false;
+        list.push_back(std::move(dev));
+    }
+    std::lock_guard<std::mutex> lock(mDevicesMutex);
+    mDevices = std::move(list);
+}
+
+/*
+ * setOptions - DiskStats supports following options
+ *     diskstats.devices : comma separated block devices under /sys/block (default: sda)
+ *     diskstats.disabled : 1 - to stop collecting; 0 - enabled
+ *     diskstats.debug : 1 - to enable debug log; 0 - disabled
+ */
+void DiskStats::setOptions(const std::string &key, const std::string &value) {
+    if (key == DISKSTATS_DEVICES) {
+        setDevices(value);
+        LOG_TO(SYSTEM, INFO) << "set devices " << value;
+    } else if (key == DISKSTATS_DISABLED || key == DISKSTATS_DEBUG) {
+        uint32_t val = 0;
+        if (!base::ParseUint(value, &val)) {
+            LOG_TO(SYSTEM, ERROR) << "Invalid value: " << value;
+            return;
+        }
+        if (key == DISKSTATS_DISABLED) {
+            mDisabled = (val != 0);
+            LOG_TO(SYSTEM, INFO) << "set disabled " << mDisabled;
+        } else {
+            cDebug = (val != 0);
+            LOG_TO(SYSTEM, INFO) << "set debug " << cDebug;
+        }
+    }
+}
+
+bool DiskStats::readStat(BlockDevice *dev, BlockStat *stat) {
+    // Keep the sysfs file open and re-read it with pread from offset 0
+    if (dev->fd < 0) {
+        std::string path = "/sys/block/" + dev->name + "/stat";
+        dev->fd.reset(TEMP_FAILURE_RETRY(open(path.c_str(), O_RDONLY | O_CLOEXEC)));
+        if (dev->fd < 0) {
+            PLOG_TO(SYSTEM, ERROR) << "Fail to open " << path;
+            return false;
+        }
+    }
+    if (!readFdToBuffer(dev->fd, &mBuffer)) {
+        PLOG_TO(SYSTEM, ERROR) << "Fail to read stat of " << dev->name;
+        dev->fd.reset();
+        return false;
+    }
+    uint64_t *fields[] = {
+        &stat->readIos,     &stat->readMerges,    &stat->readSectors,    &stat->readTicks,
+        &stat->writeIos,    &stat->writeMerges,   &stat->writeSectors,   &stat->writeTicks,
+        &stat->inFlight,    &stat->ioTicks,       &stat->timeInQueue,    &stat->discardIos,
+        &stat->discardMerges, &stat->discardSectors, &stat->discardTicks,
+    };
+    *stat = {};
+    TextScanner scanner(mBuffer);
+    size_t count = 0;
+    while (count < sizeof(fields) / sizeof(fields[0]) && scanner.parseUint(fields[count])) {
+        count++;
+    }
+    // Kernels before 4.18 only have the first 11 fields
+    if (count < 11) {
+        LOG_TO(SYSTEM, ERROR) << "Invalid stat of " << dev->name << ": " << mBuffer;
+        return false;
+    }
+    return true;
+}
+
+static float perSecond(uint64_t diff, uint64_t ms) {
+    return ms ? diff * 1000.0f / ms : 0.0f;
+}
+
+static float average(uint64_t sum, uint64_t count) {
+    return count ? static_cast<float>(sum) / count : 0.0f;
+}
+
+/* Dump block device usage, one line per device; Q is the average queue depth (Sample Log)
+ *
+ * [DISK sda: 10.001s] R:85.3io/s,4120.0KB/s,0.61ms W:42.1io/s,2231.6KB/s,1.93ms
+ *     D:0.0io/s Q:0.31 busy:12.40%
+ */
+void DiskStats::refresh(void) {
+    if (mDisabled)
+        return;
+
+    std::chrono::system_clock::time_point now = std::chrono::system_clock::now();
+    std::chrono::steady_clock::time_point awake = std::chrono::steady_clock::now();
+    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(awake - mLast);
+    uint64_t interval = ms.count();
+    std::string out;
+    std::lock_guard<std::mutex> lock(mDevicesMutex);
+    for (BlockDevice &dev : mDevices) {
+        BlockStat curr;
+        if (!readStat(&dev, &curr)) {
+            dev.valid = false;
+            continue;
+        }
+        if (dev.valid) {
+            const BlockStat &prev = dev.prev;
+            uint64_t readIos = curr.readIos - prev.readIos;
+            uint64_t writeIos = curr.writeIos - prev.writeIos;
+            uint64_t readBytes = (curr.readSectors - prev.readSectors) * SECTOR_SIZE;
+            uint64_t writeBytes = (curr.writeSectors - prev.writeSectors) * SECTOR_SIZE;
+            float busy = interval ? (curr.ioTicks - prev.ioTicks) * 100.0f / interval : 0.0f;
+            // time_in_queue grows by the number of IOs in flight every ms
+            float depth =
+                interval ? static_cast<float>(curr.timeInQueue - prev.timeInQueue) / interval
+                         : 0.0f;
+            out.append(android::base::StringPrintf(
+                FMT_DISK, dev.name.c_str(), ms.count() / 1000, ms.count() % 1000,
+                perSecond(readIos, interval), perSecond(readBytes, interval) / 1024,
+                average(curr.readTicks - prev.readTicks, readIos), perSecond(writeIos, interval),
+                perSecond(writeBytes, interval) / 1024,
+                average(curr.writeTicks - prev.writeTicks, writeIos),
+                perSecond(curr.discardIos - prev.discardIos, interval), depth,
+                std::min(busy, 100.0f)));
+        }
+        dev.prev = curr;
+        dev.valid = true;
+    }
+    mLast = awake;
+    if (out.empty())
+        return;
+    if (cDebug)
+        LOG_TO(SYSTEM, INFO) << out;
+    append(now, out);
+}
@@ -0,0 +1,278 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "perfstatsd_f2fs"
+
+#include "f2fs_stats.h"
+#include <android-base/stringprintf.h>
+#include <android-base/strings.h>
+#include <fcntl.h>
+#include <cstring>
+#include "text_parser.h"
+
+using namespace android::pixel::perfstatsd;
+
+static constexpr const char *F2FS_SYSFS_DIR = "/sys/fs/f2fs/";
+static constexpr const char *F2FS_STATUS_PATH = "/sys/kernel/debug/f2fs/status";
+// Indexed by F2fsCounter
+static constexpr const char *F2FS_NODES[F2FS_COUNTER_MAX] = {
+    "gc_foreground_calls", "gc_background_calls", "cp_foreground_calls",
+    "cp_background_calls", "dirty_segments",      "free_segments",
+};
+
+static constexpr char FMT_F2FS[] =
+    "[F2FS %s: %lld.%03llds] GC:fg=%" PRIu64 ",bg=%" PRIu64 " CP:fg=%" PRIu64 ",bg=%" PRIu64
+    " cp/gc=%.2f dirty:%" PRIu64 "(%+" PRId64 ") free:%" PRIu64 "(%+" PRId64 ")";
+static constexpr char FMT_F2FS_CP_PEAK[] = " cp_peak:%" PRIu64 "ms";
+static constexpr char FMT_F2FS_WRITER[] = " %u %s %" PRIu64 "KB;";
+
+static bool cDebug = false;
+
+F2fsStats::F2fsStats(std::function<IoUsage *()> ioUsage)
+    : mIoUsage(std::move(ioUsage)), mDisabled(false), mStatusRead(false) {
+    mLast = std::chrono::steady_clock::now();
+    discoverDevices();
+}
+
+void F2fsStats::discoverDevices(void) {
+    std::vector<std::string> names;
+    DIR *dir = opendir(F2FS_SYSFS_DIR);
+    if (dir == NULL) {
+        LOG_TO(SYSTEM, WARNING) << "Fail to open " << F2FS_SYSFS_DIR;
+        return;
+    }
+    struct dirent *ent;
+    while ((ent = readdir(dir)) != NULL) {
+        std::string name = ent->d_name;
+        if (name == "." || name == ".." || name == "features") {
+            continue;
+        }
+        names.push_back(name);
+    }
+    closedir(dir);
+    setDevices(android::base::Join(names, ","));
+}
+
+void F2fsStats::setDevices(const std::string &devices) {
+    std::vector<F2fsDevice> list;
+    for (const auto &name : android::base::Split(devices, ",")) {
+        if (name.empty()) {
+            continue;
+        }
+        F2fsDevice dev;
+        dev.name = name;
+        dev.valid = false;
+        for (int i = 0; i < F2FS_COUNTER_MAX; i++) {
+            std::string path = F2FS_SYSFS_DIR + name + "/" + F2FS_NODES[i];
+            // Older kernels lack some nodes; those counters come from debugfs
+            dev.fds[i].reset(TEMP_FAILURE_RETRY(open(path.c_str(), O_RDONLY | O_CLOEXEC)));
+        }
+        list.push_back(std::move(dev));
+    }
+    std::lock_guard<std::mutex> lock(mDevicesMutex);
+    mDevices = std::move(list);
+}
+
+/*
+ * setOptions - F2fsStats supports following options
+ *     f2fsstats.devices : comma separated devices under /sys/fs/f2fs (default: all)
+ *     f2fsstats.disabled : 1 - to stop collecting; 0 - enabled
+ *     f2fsstats.debug : 1 - to enable debug log; 0 - disabled
+ */
+void F2fsStats::setOptions(const std::string &key, const std::string &value) {
+    if (key == F2FSSTATS_DEVICES) {
+        setDevices(value);
+        LOG_TO(SYSTEM, INFO) << "set devices " << value;
+    } else if (key == F2FSSTATS_DISABLED || key == F2FSSTATS_DEBUG) {
+        uint32_t val = 0;
+        if (!base::ParseUint(value, &val)) {
+            LOG_TO(SYSTEM, ERROR) << "Invalid value: " << value;
+            return;
+        }
+        if (key == F2FSSTATS_DISABLED) {
+            mDisabled = (val != 0);
+            LOG_TO(SYSTEM, INFO) << "set disabled " << mDisabled;
+        } else {
+            cDebug = (val != 0);
+            LOG_TO(SYSTEM, INFO) << "set debug " << cDebug;
+        }
+    }
+}
+
+/*
+ * Parse the section of |name| in the f2fs debugfs status, e.g.
+ *   =====[ partition info(sda34). #0, RW, CP: Good]=====
+ *     - Dirty: 215
+ *     - Free: 50235 (50235)
+ *   CP calls: 10516 (BG: 8833)
+ *   CP merge (Queued:    0, Issued:    0, Total:    0, Cur time:    0(ms), Peak time:    0(ms))
+ *   GC calls: 86 (BG: 86)
+ * Only counters still set to F2FS_NO_VALUE are filled in.
+ */
+bool F2fsStats::readStatus(const std::string &name, uint64_t *counters, uint64_t *cpPeakMs) {
+    if (!mStatusRead) {
+        mStatusRead = true;
+        if (!readFileToBuffer(F2FS_STATUS_PATH, &mStatus) && cDebug) {
+            LOG_TO(SYSTEM, WARNING) << "Fail to read " << F2FS_STATUS_PATH;
+        }
+    }
+    return parseStatus(mStatus, name, counters, cpPeakMs);
+}
+
+bool F2fsStats::parseStatus(std::string_view status, const std::string &name,
+                            uint64_t *counters, uint64_t *cpPeakMs) {
+    std::string header = "partition info(" + name + ")";
+    size_t start = status.find(header);
+    if (start == std::string_view::npos) {
+        return false;
+    }
+    size_t end = status.find("=====[", start + header.size());
+    if (end == std::string_view::npos) {
+        end = status.size();
+    }
+    std::string_view section = status.substr(start, end - start);
+
+    uint64_t values[F2FS_COUNTER_MAX];
+    std::fill(values, values + F2FS_COUNTER_MAX, F2FS_NO_VALUE);
+    TextScanner scanner(section);
+    for (; !scanner.atEnd(); scanner.nextLine()) {
+        scanner.skipSpaces();
+        uint64_t total, bg;
+        if (scanner.consume("- Dirty:")) {
+            scanner.parseUint(&values[F2FS_DIRTY_SEGS]);
+        } else if (scanner.consume("- Free:")) {
+            scanner.parseUint(&values[F2FS_FREE_SEGS]);
+        } else if (scanner.consume("CP calls:")) {
+            if (scanner.parseUint(&total) && scanner.skipPast('(') && scanner.consume("BG:") &&
+                scanner.parseUint(&bg)) {
+                values[F2FS_CP_FG] = total - bg;
+                values[F2FS_CP_BG] = bg;
+            }
+        } else if (scanner.consume("GC calls:")) {
+            if (scanner.parseUint(&total) && scanner.skipPast('(') && scanner.consume("BG:") &&
+                scanner.parseUint(&bg)) {
+                values[F2FS_GC_FG] = total - bg;
+                values[F2FS_GC_BG] = bg;
+            }
+        } else if (scanner.consume("CP merge")) {
+            std::string_view line = scanner.restOfLine();
+            size_t pos = line.find("Peak time:");
+            if (pos != std::string_view::npos) {
+                TextScanner peak(line.substr(pos + std::strlen("Peak time:")));
+                peak.parseUint(cpPeakMs);
+            }
+        }
+    }
+    for (int i = 0; i < F2FS_COUNTER_MAX; i++) {
+        if (counters[i] == F2FS_NO_VALUE) {
+            counters[i] = values[i];
+        }
+    }
+    return true;
+}
+
+bool F2fsStats::readCounters(F2fsDevice *dev, uint64_t *counters, uint64_t *cpPeakMs) {
+    bool missing = false;
+    for (int i = 0; i < F2FS_COUNTER_MAX; i++) {
+        counters[i] = F2FS_NO_VALUE;
+        if (dev->fds[i] < 0) {
+            missing = true;
+            continue;
+        }
+        if (!readFdToBuffer(dev->fds[i], &mBuffer) ||
+            !TextScanner(mBuffer).parseUint(&counters[i])) {
+            counters[i] = F2FS_NO_VALUE;
+            missing = true;
+        }
+    }
+    // Checkpoint timing is only in the debugfs status; it also fills in the
+    // counters older kernels lack in sysfs
+    *cpPeakMs = F2FS_NO_VALUE;
+    if (!readStatus(dev->name, counters, cpPeakMs) && missing && cDebug) {
+        LOG_TO(SYSTEM, WARNING) << dev->name << ": not in " << F2FS_STATUS_PATH;
+    }
+    for (int i = 0; i < F2FS_COUNTER_MAX; i++) {
+        if (counters[i] == F2FS_NO_VALUE) {
+            if (cDebug)
+                LOG_TO(SYSTEM, WARNING) << dev->name << ": no value for " << F2FS_NODES[i];
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Dump f2fs activity (Sample Log)
+ *
+ * [F2FS sda34: 10.001s] GC:fg=2,bg=0 CP:fg=1,bg=3 cp/gc=2.00 dirty:215(+12) free:50235(-20)
+ * [F2FS_FG_GC sda34] top writers: 10061 android.vending 20480KB; 1000 system 4096KB;
+ */
+void F2fsStats::refresh(void) {
+    if (mDisabled)
+        return;
+
+    std::chrono::system_clock::time_point now = std::chrono::system_clock::now();
+    std::chrono::steady_clock::time_point awake = std::chrono::steady_clock::now();
+    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(awake - mLast);
+    mStatusRead = false;
+    std::string out;
+    std::lock_guard<std::mutex> lock(mDevicesMutex);
+    for (F2fsDevice &dev : mDevices) {
+        uint64_t curr[F2FS_COUNTER_MAX];
+        uint64_t cpPeakMs;
+        if (!readCounters(&dev, curr, &cpPeakMs)) {
+            dev.valid = false;
+            continue;
+        }
+        if (dev.valid) {
+            uint64_t diff[F2FS_COUNTER_MAX];
+            for (int i = 0; i < F2FS_COUNTER_MAX; i++) {
+                diff[i] = curr[i] - dev.prev[i];
+            }
+            uint64_t gc = diff[F2FS_GC_FG] + diff[F2FS_GC_BG];
+            uint64_t cp = diff[F2FS_CP_FG] + diff[F2FS_CP_BG];
+            out.append(android::base::StringPrintf(
+                FMT_F2FS, dev.name.c_str(), ms.count() / 1000, ms.count() % 1000,
+                diff[F2FS_GC_FG], diff[F2FS_GC_BG], diff[F2FS_CP_FG], diff[F2FS_CP_BG],
+                gc ? static_cast<float>(cp) / gc : 0.0f, curr[F2FS_DIRTY_SEGS],
+                static_cast<int64_t>(diff[F2FS_DIRTY_SEGS]), curr[F2FS_FREE_SEGS],
+                static_cast<int64_t>(diff[F2FS_FREE_SEGS])));
+            if (cpPeakMs != F2FS_NO_VALUE) {
+                out.append(android::base::StringPrintf(FMT_F2FS_CP_PEAK, cpPeakMs));
+            }
+            out.append("\n");
+            // Foreground GC stalls writers; name who was writing in this tick
+            IoUsage *ioUsage = diff[F2FS_GC_FG] > 0 ? mIoUsage() : nullptr;
+            if (ioUsage != nullptr &&
+                ioUsage->getTopWriters(tick(), F2FS_TOP_WRITERS, &mTopWriters)) {
+                out.append("[F2FS_FG_GC " + dev.name + "] top writers:");
+                for (const auto &writer : mTopWriters) {
+                    out.append(android::base::StringPrintf(
+                        FMT_F2FS_WRITER, std::get<0>(writer), std::get<1>(writer).c_str(),
+                        std::get<2>(writer) / 1024));
+                }
+                out.append("\n");
+            }
+        }
+        std::copy(curr, curr + F2FS_COUNTER_MAX, dev.prev);
+        dev.valid = true;
+    }
+    mLast = awake;
+    if (out.empty())
+        return;
+    if (cDebug)
+        LOG_TO(SYSTEM, INFO) << out;
+    append(now, out);
+}
@@ -0,0 +1,82 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _BINDER_STATS_H_
+#define _BINDER_STATS_H_
+
+#include <proc_snapshot.h>
+#include <statstype.h>
+
+#define BINDER_STATS_BUFFER_SIZE (6 * 30)
+#define BINDER_TOP_DEFAULT (5)
+
+#define BINDERSTATS_TOPCOUNT "binderstats.topcount"
+#define BINDERSTATS_DISABLED "binderstats.disabled"
+#define BINDERSTATS_DEBUG "binderstats.debug"
+
+namespace android {
+namespace pixel {
+namespace perfstatsd {
+
+// Per process binder counters, summed over the binder contexts of the process
+struct BinderProc {
+    uint32_t pid;
+    uint64_t outgoing;  // BC_TRANSACTION(_SG), calls made
+    uint64_t incoming;  // BR_TRANSACTION(_SEC_CTX), calls served
+    uint64_t spawned;   // BR_SPAWN_LOOPER, thread pool growth requests
+    // Gauges
+    uint32_t pending;     // transactions queued to the process
+    uint32_t ready;       // idle looper threads
+    uint32_t started;     // looper threads spawned on request
+    uint32_t maxThreads;  // thread pool size
+    bool exhausted;       // some context has no idle thread and can't spawn more
+};
+
+/*
+ * BinderStats - binder transactions and thread pool pressure per process
+ *
+ * The binder stats file can be hundreds of KB; it is read into a reused
+ * buffer and scanned in place into a reused table, then merge-joined by pid
+ * with the table of the previous tick.
+ */
+class BinderStats : public StatsType {
+  public:
+    BinderStats(const sp<ProcSnapshot> &snapshot);
+    void refresh(void);
+    void setOptions(const std::string &key, const std::string &value);
+    // Parse the binder stats text into per process counters, sorted by pid
+    static void parseStats(std::string_view text, std::vector<BinderProc> *out);
+
+  private:
+    sp<ProcSnapshot> mProcSnapshot;
+    std::chrono::steady_clock::time_point mLast;  // awake time, excludes suspend
+    bool mDisabled;
+    bool mValid;  // mPrevious holds a sample
+    uint32_t mTopCount;
+    const char *mPath;
+    std::string mBuffer;
+    std::vector<BinderProc> mCurrent;   // sorted by pid
+    std::vector<BinderProc> mPrevious;  // sorted by pid
+    std::vector<BinderProc> mDiffs;     // counters as deltas, gauges as is
+    bool readStats(void);
+    void calcDiffs(void);
+};
+
+}  // namespace perfstatsd
+}  // namespace pixel
+}  // namespace android
+
+#endif /*  _BINDER_STATS_H_ */
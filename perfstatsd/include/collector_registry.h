@@ -0,0 +1,50 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _COLLECTOR_REGISTRY_H_
+#define _COLLECTOR_REGISTRY_H_
+
+#include <proc_snapshot.h>
+#include <statstype.h>
+#include <functional>
+
+namespace android {
+namespace pixel {
+namespace perfstatsd {
+
+struct CollectorContext {
+    sp<ProcSnapshot> snapshot;
+    // The collector already created under |name|, or nullptr
+    std::function<StatsType *(const std::string &name)> find;
+};
+
+struct CollectorInfo {
+    const char *name;
+    size_t bufferSize;
+    StatsType *(*create)(const CollectorContext &context);
+};
+
+/*
+ * Every collector perfstatsd knows about, in refresh order: a collector may
+ * look up the ones listed before it through CollectorContext::find().
+ */
+const std::vector<CollectorInfo> &getCollectorRegistry(void);
+
+}  // namespace perfstatsd
+}  // namespace pixel
+}  // namespace android
+
+#endif /* _COLLECTOR_REGISTRY_H_ */
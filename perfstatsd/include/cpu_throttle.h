@@ -0,0 +1,73 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _CPU_THROTTLE_H_
+#define _CPU_THROTTLE_H_
+
+#include <android-base/unique_fd.h>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace android {
+namespace pixel {
+namespace perfstatsd {
+
+struct CpuPolicy {
+    std::string name;  // policyN
+    uint32_t cpu;      // N, the first cpu of the policy
+    uint64_t maxFreq;  // cpuinfo_max_freq
+    android::base::unique_fd capFd;  // scaling_max_freq
+    bool capValid;                   // prevCap holds a sample
+    uint64_t prevCap;
+    // cpufreq cooling state i caps the policy at freqs[i], highest first
+    std::vector<uint64_t> freqs;
+    android::base::unique_fd cdevFd;  // stats/time_in_state_ms of the cooling device
+    bool cdevValid;                   // prevStateMs holds a sample
+    std::vector<uint64_t> prevStateMs;
+    std::vector<uint64_t> currStateMs;
+};
+
+/*
+ * CpuThrottle - frequency caps of the cpufreq policies per interval
+ *
+ * The cap of a policy is its scaling_max_freq against cpuinfo_max_freq.
+ * When its cpufreq cooling device keeps statistics, the residency of every
+ * cooling state gives the time weighted cap of the interval, bounded by the
+ * other limits on scaling_max_freq; otherwise the cap is sampled at both
+ * ends of the interval and assumed to have changed halfway.
+ */
+class CpuThrottle {
+  public:
+    CpuThrottle(void);
+    void sample(std::string *out);
+    // Parse stats/time_in_state_ms of a cooling device into currStateMs
+    static bool parseStates(std::string_view text, CpuPolicy *policy);
+
+  private:
+    std::vector<CpuPolicy> mPolicies;
+    std::string mBuffer;
+    void discoverPolicies(void);
+    void bindCoolingDevices(void);
+    bool readUint(int fd, uint64_t *value);
+    bool readStates(CpuPolicy *policy);
+};
+
+}  // namespace perfstatsd
+}  // namespace pixel
+}  // namespace android
+
+#endif /*  _CPU_THROTTLE_H_ */
@@ -17,16 +17,24 @@
 #ifndef _CPU_USAGE_H_
 #define _CPU_USAGE_H_
 
+#include <cpu_throttle.h>
+#include <ewma_baseline.h>
+#include <proc_snapshot.h>
 #include <statstype.h>
 
 #define CPU_USAGE_BUFFER_SIZE (6 * 30)
 #define TOP_PROCESS_COUNT (5)
 #define CPU_USAGE_PROFILE_THRESHOLD (50)
+#define CPU_ANOMALY_MIN_DEVIATION (10.0f)  // %
 
 #define PROCPROF_THRESHOLD "cpu.procprof.threshold"
 #define CPU_DISABLED "cpu.disabled"
 #define CPU_DEBUG "cpu.debug"
 #define CPU_TOPCOUNT "cpu.topcount"
+#define CPU_ANOMALY_SIGMA "cpu.anomaly.sigma"
+#define CPU_SCAN_PIDS "cpu.scan.pids"
+#define CPU_SCAN_US "cpu.scan.us"
+#define CPU_THROTTLE "cpu.throttle"
 
 namespace android {
 namespace pixel {
@@ -40,42 +48,67 @@ struct CpuData {
     uint64_t ioUsage;
 };
 
+// Usage of one process over its last sample interval, ranked within a tick
 struct ProcData {
     uint32_t pid;
-    std::string name;
+    std::string_view name;  // ProcIdentity::comm, valid within the tick
     float usageRatio;
+    uint64_t user;
+    uint64_t system;
+};
+
+// Counters of the last read of a process, kept across ticks
+struct ProcCounters {
+    uint64_t starttime;  // tells a reused pid apart
     uint64_t usage;
     uint64_t user;
     uint64_t system;
+    std::chrono::steady_clock::time_point time;  // when usage was read
+};
+
+struct ProcdataCompare {
+    // sort process by usage percentage in descending order
+    bool operator()(const ProcData &a, const ProcData &b) const {
+        return a.usageRatio < b.usageRatio;
+    }
 };
 
 class CpuUsage : public StatsType {
   public:
-    CpuUsage(void);
+    CpuUsage(const sp<ProcSnapshot> &snapshot);
     void refresh(void);
     void setOptions(const std::string &key, const std::string &value);
 
   private:
-    std::chrono::system_clock::time_point mLast;
+    sp<ProcSnapshot> mProcSnapshot;
+    std::chrono::steady_clock::time_point mLast;  // awake time, excludes suspend
     uint32_t mCores;  // cpu core num
     uint32_t mProfileThreshold;
     uint32_t mTopcount;
     bool mDisabled;
-    bool mProfileProcess;
+    uint64_t mTicks = 0;         // refreshes so far
+    uint64_t mProfiledTick = 0;  // refresh of the last process pass, 0 for none
     CpuData mPrevUsage;                                    // cpu usage of last record
     std::vector<CpuData> mPrevCoresUsage;                  // cpu usage per core of last record
-    std::unordered_map<uint32_t, ProcData> mPrevProcdata;  // <pid, last_usage>
+    std::unordered_map<uint32_t, ProcCounters> mPrevProcdata;  // <pid, last_usage>
+    // Budgeted scan: at most mScanPids pids or mScanUs per profile, 0 for no
+    // limit, resuming after mScanCursor; mHotPids, the last top, always go.
+    uint32_t mScanPids;
+    uint32_t mScanUs;
+    uint32_t mScanCursor;
+    std::vector<uint32_t> mHotPids;
+    long mClkTck;
     uint64_t mDiffCpu;
     float mTotalRatio;
-    void getOverallUsage(std::chrono::system_clock::time_point &, std::string *);
+    EwmaBaseline mBaseline;  // of mTotalRatio
+    std::vector<float> mMetrics;  // total, user, sys, io, then one per core
+    size_t mTotalHistogram;
+    size_t mCoreHistograms;  // id of the cpu0 histogram, the other cores follow
+    std::unique_ptr<CpuThrottle> mThrottle;  // null unless cpu.throttle is set
+    void getOverallUsage(std::chrono::steady_clock::time_point &, std::string *);
     void profileProcess(std::string *);
-};
-
-struct ProcdataCompare {
-    // sort process by usage percentage in descending order
-    bool operator()(const ProcData &a, const ProcData &b) const {
-        return a.usageRatio < b.usageRatio;
-    }
+    void sampleProcess(uint32_t pid, std::chrono::steady_clock::time_point now,
+                       std::priority_queue<ProcData, std::vector<ProcData>, ProcdataCompare> *);
 };
 
 }  // namespace perfstatsd
@@ -0,0 +1,72 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _DEVFREQ_STATS_H_
+#define _DEVFREQ_STATS_H_
+
+#include <android-base/unique_fd.h>
+#include <statstype.h>
+
+#define DEVFREQ_STATS_BUFFER_SIZE (6 * 30)
+
+#define DEVFREQSTATS_DISABLED "devfreqstats.disabled"
+#define DEVFREQSTATS_DEBUG "devfreqstats.debug"
+
+namespace android {
+namespace pixel {
+namespace perfstatsd {
+
+struct DevfreqDevice {
+    std::string name;
+    android::base::unique_fd fd;  // trans_stat
+    bool valid;                   // prevMs holds a sample
+    // One entry per row of trans_stat; sized on the first read
+    std::vector<uint64_t> freqs;   // Hz
+    std::vector<uint64_t> prevMs;  // residency
+    std::vector<uint64_t> currMs;
+};
+
+/*
+ * DevfreqStats - frequency residency of devfreq devices (DDR, interconnect,
+ * GPU, accelerators) per interval
+ *
+ * Devices under /sys/class/devfreq are found once at startup and their
+ * trans_stat stays open. Rows are parsed in place into the vectors of the
+ * device, so polling does not allocate unless the frequency table changes.
+ */
+class DevfreqStats : public StatsType {
+  public:
+    DevfreqStats(void);
+    void refresh(void);
+    void setOptions(const std::string &key, const std::string &value);
+    // Parse trans_stat into the frequency table and currMs of |dev|; false if
+    // it has no frequency rows
+    static bool parseTransStat(std::string_view text, DevfreqDevice *dev);
+
+  private:
+    std::chrono::steady_clock::time_point mLast;  // awake time, excludes suspend
+    bool mDisabled;
+    std::vector<DevfreqDevice> mDevices;
+    std::string mBuffer;
+    void discoverDevices(void);
+    bool readTransStat(DevfreqDevice *dev);
+};
+
+}  // namespace perfstatsd
+}  // namespace pixel
+}  // namespace android
+
+#endif /*  _DEVFREQ_STATS_H_ */
@@ -0,0 +1,81 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _DISK_STATS_H_
+#define _DISK_STATS_H_
+
+#include <android-base/unique_fd.h>
+#include <statstype.h>
+
+#define DISK_STATS_BUFFER_SIZE (6 * 30)
+#define DISK_STATS_DEFAULT_DEVICES "sda"
+
+#define DISKSTATS_DEVICES "diskstats.devices"
+#define DISKSTATS_DISABLED "diskstats.disabled"
+#define DISKSTATS_DEBUG "diskstats.debug"
+
+namespace android {
+namespace pixel {
+namespace perfstatsd {
+
+// Counters of /sys/block/<dev>/stat, see Documentation/block/stat.txt
+struct BlockStat {
+    uint64_t readIos;
+    uint64_t readMerges;
+    uint64_t readSectors;
+    uint64_t readTicks;  // ms
+    uint64_t writeIos;
+    uint64_t writeMerges;
+    uint64_t writeSectors;
+    uint64_t writeTicks;  // ms
+    uint64_t inFlight;
+    uint64_t ioTicks;  // ms the device had IO in flight
+    uint64_t timeInQueue;  // ms, weighted by the number of IOs in flight
+    uint64_t discardIos;  // discard fields exist since kernel 4.18
+    uint64_t discardMerges;
+    uint64_t discardSectors;
+    uint64_t discardTicks;
+};
+
+struct BlockDevice {
+    std::string name;
+    android::base::unique_fd fd;
+    bool valid;  // prev holds a sample
+    BlockStat prev;
+};
+
+class DiskStats : public StatsType {
+  public:
+    DiskStats(void);
+    void refresh(void);
+    void setOptions(const std::string &key, const std::string &value);
+
+  private:
+    std::chrono::steady_clock::time_point mLast;  // awake time, excludes suspend
+    bool mDisabled;
+    // diskstats.devices arrives on a binder thread while refresh() walks mDevices
+    std::mutex mDevicesMutex;
+    std::vector<BlockDevice> mDevices;
+    std::string mBuffer;
+    void setDevices(const std::string &devices);
+    bool readStat(BlockDevice *dev, BlockStat *stat);
+};
+
+}  // namespace perfstatsd
+}  // namespace pixel
+}  // namespace android
+
+#endif /*  _DISK_STATS_H_ */
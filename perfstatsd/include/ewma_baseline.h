@@ -0,0 +1,82 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _EWMA_BASELINE_H_
+#define _EWMA_BASELINE_H_
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+#define ANOMALY_DEFAULT_SIGMA (3)
+#define ANOMALY_SPAN (30)           // samples, the baseline follows ~5 min of history
+#define ANOMALY_WARMUP_SAMPLES (6)  // no verdict before the baseline has settled
+
+namespace android {
+namespace pixel {
+namespace perfstatsd {
+
+/*
+ * EwmaBaseline - online mean and variance of one metric
+ *
+ * update() marks samples more than |sigma| standard deviations above the
+ * exponentially weighted mean and then folds them in, so a lasting change of
+ * level stops being anomalous after a few intervals. |minDeviation| keeps a
+ * flat, near zero variance metric from flagging small wiggles.
+ */
+class EwmaBaseline {
+  public:
+    EwmaBaseline(float minDeviation)
+        : mSigma(ANOMALY_DEFAULT_SIGMA),
+          mMinDeviation(minDeviation),
+          mAlpha(2.0f / (ANOMALY_SPAN + 1)),
+          mMean(0.0f),
+          mVariance(0.0f),
+          mCount(0) {}
+    // 0 disables detection; callers then fall back to their fixed thresholds
+    void setSigma(uint32_t sigma) { mSigma = sigma; }
+    bool active() const { return mSigma > 0 && mCount >= ANOMALY_WARMUP_SAMPLES; }
+    float mean() const { return mMean; }
+    float stddev() const { return std::sqrt(mVariance); }
+    bool update(float value) {
+        bool anomalous =
+            active() && value - mMean > std::max(mSigma * stddev(), mMinDeviation);
+        if (mCount == 0) {
+            mMean = value;
+        } else {
+            float diff = value - mMean;
+            float incr = mAlpha * diff;
+            mMean += incr;
+            mVariance = (1.0f - mAlpha) * (mVariance + diff * incr);
+        }
+        mCount++;
+        return anomalous;
+    }
+
+  private:
+    uint32_t mSigma;
+    float mMinDeviation;
+    float mAlpha;
+    float mMean;
+    float mVariance;
+    uint32_t mCount;
+};
+
+}  // namespace perfstatsd
+}  // namespace pixel
+}  // namespace android
+
+#endif /* _EWMA_BASELINE_H_ */
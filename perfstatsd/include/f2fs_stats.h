@@ -0,0 +1,95 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _F2FS_STATS_H_
+#define _F2FS_STATS_H_
+
+#include <android-base/unique_fd.h>
+#include <io_usage.h>
+#include <statstype.h>
+#include <functional>
+
+#define F2FS_STATS_BUFFER_SIZE (6 * 30)
+#define F2FS_TOP_WRITERS (3)
+#define F2FS_NO_VALUE UINT64_MAX  // counter not available
+
+#define F2FSSTATS_DEVICES "f2fsstats.devices"
+#define F2FSSTATS_DISABLED "f2fsstats.disabled"
+#define F2FSSTATS_DEBUG "f2fsstats.debug"
+
+namespace android {
+namespace pixel {
+namespace perfstatsd {
+
+enum F2fsCounter {
+    F2FS_GC_FG = 0,
+    F2FS_GC_BG,
+    F2FS_CP_FG,
+    F2FS_CP_BG,
+    F2FS_DIRTY_SEGS,
+    F2FS_FREE_SEGS,
+    F2FS_COUNTER_MAX,
+};
+
+struct F2fsDevice {
+    std::string name;
+    // /sys/fs/f2fs/<dev>/ node per counter; closed when the kernel lacks it
+    android::base::unique_fd fds[F2FS_COUNTER_MAX];
+    bool valid;  // prev holds a sample
+    uint64_t prev[F2FS_COUNTER_MAX];
+};
+
+/*
+ * F2fsStats - f2fs GC and checkpoint activity per interval
+ *
+ * Counters come from /sys/fs/f2fs/<dev>/ where the kernel exports them and
+ * from the f2fs debugfs status otherwise; the checkpoint peak time is only
+ * in the status. Intervals with foreground GC are
+ * annotated with the top IO writers of the same tick.
+ */
+class F2fsStats : public StatsType {
+  public:
+    // |ioUsage| returns the io collector, or nullptr while it doesn't exist
+    F2fsStats(std::function<IoUsage *()> ioUsage);
+    void refresh(void);
+    void setOptions(const std::string &key, const std::string &value);
+    // Parse the section of |name| in the debugfs status; fills the counters
+    // still at F2FS_NO_VALUE and the checkpoint peak. False if not listed.
+    static bool parseStatus(std::string_view status, const std::string &name, uint64_t *counters,
+                            uint64_t *cpPeakMs);
+
+  private:
+    std::function<IoUsage *()> mIoUsage;
+    std::chrono::steady_clock::time_point mLast;  // awake time, excludes suspend
+    bool mDisabled;
+    // f2fsstats.devices arrives on a binder thread while refresh() walks mDevices
+    std::mutex mDevicesMutex;
+    std::vector<F2fsDevice> mDevices;
+    std::string mBuffer;
+    std::string mStatus;  // debugfs status, read at most once per tick
+    bool mStatusRead;
+    std::vector<std::tuple<uint32_t, std::string, uint64_t>> mTopWriters;
+    void setDevices(const std::string &devices);
+    void discoverDevices(void);
+    bool readCounters(F2fsDevice *dev, uint64_t *counters, uint64_t *cpPeakMs);
+    bool readStatus(const std::string &name, uint64_t *counters, uint64_t *cpPeakMs);
+};
+
+}  // namespace perfstatsd
+}  // namespace pixel
+}  // namespace android
+
+#endif /*  _F2FS_STATS_H_ */
@@ -16,15 +16,21 @@
 #ifndef _IO_USAGE_H_
 #define _IO_USAGE_H_
 
+#include <ewma_baseline.h>
+#include <proc_snapshot.h>
 #include <statstype.h>
 #include <chrono>
 #include <sstream>
 #include <string>
+#include <string_view>
+#include <tuple>
 
 #include <unordered_map>
 
 #define IO_USAGE_BUFFER_SIZE (6 * 30)
 #define IO_TOP_MAX 5
+#define IO_RANK_DEFAULT "read,write"
+#define IO_ANOMALY_MIN_DEVIATION (10.0f)  // MB per interval
 
 namespace android {
 namespace pixel {
@@ -32,16 +38,59 @@ namespace perfstatsd {
 
 class ProcPidIoStats {
   private:
+    sp<ProcSnapshot> mProcSnapshot;
     std::chrono::system_clock::time_point mCheckTime;
-    std::vector<uint32_t> mPrevPids;
-    std::vector<uint32_t> mCurrPids;
-    std::unordered_map<uint32_t, std::string> mUidNameMapping;
+    struct UidName {
+        std::string name;
+        uint32_t pids = 0;  // live processes seen with this uid
+    };
+    std::vector<uint32_t> mPrevPids;  // sorted
+    std::vector<uint32_t> mCurrPids;  // sorted
+    std::vector<uint32_t> mNewPids;
+    std::vector<uint32_t> mExitedPids;
+    std::vector<std::pair<uint32_t, uint32_t>> mPidUids;  // <pid, uid> sorted by pid
+    std::unordered_map<uint32_t, UidName> mUidNameMapping;
+    // At most this many new pids or us per update, 0 for no limit; the rest
+    // stay new and are read by the following updates
+    uint32_t mScanPids = 0;
+    uint32_t mScanUs = 0;
     // functions
-    std::vector<uint32_t> getNewPids();
+    void diffPids(std::vector<uint32_t> *newPids, std::vector<uint32_t> *exitedPids);
+    void removeExitedPids(const std::vector<uint32_t> &exitedPids);
 
   public:
+    ProcPidIoStats(const sp<ProcSnapshot> &snapshot) : mProcSnapshot(snapshot) {}
     void update(bool forceAll);
     bool getNameForUid(uint32_t uid, std::string *name);
+    void setScanBudget(uint32_t pids, uint32_t us) {
+        mScanPids = pids;
+        mScanUs = us;
+    }
+};
+
+/*
+ * UidNameCache - persistent uid -> name mapping
+ *
+ * App uids are seeded from packages.list, which is reloaded only when its
+ * mtime changes. Other uids fall back to getpwuid() and, once per tick at
+ * most, to the /proc/<pid>/status walk of ProcPidIoStats.
+ */
+class UidNameCache {
+  private:
+    struct timespec mPackagesMtime = {};
+    bool mProcScanned = false;
+    std::unordered_map<uint32_t, std::string> mNames;
+    ProcPidIoStats mProcIoStats;
+    void reloadPackagesIfChanged();
+    bool resolve(uint32_t uid, std::string *name);
+
+  public:
+    UidNameCache(const sp<ProcSnapshot> &snapshot) : mProcIoStats(snapshot) {}
+    void setScanBudget(uint32_t pids, uint32_t us) { mProcIoStats.setScanBudget(pids, us); }
+    // Start of a new tick: allow one more /proc walk and check packages.list
+    void invalidate();
+    // Returns the name of |uid|, or "-" when it can't be resolved
+    const char *getName(uint32_t uid);
 };
 
 struct UserIo {
@@ -88,9 +137,11 @@ struct UserIo {
         return r;
     }
 
-    uint64_t sumWrite() { return fgWrite + bgWrite; }
+    uint64_t sumWrite() const { return fgWrite + bgWrite; }
 
-    uint64_t sumRead() { return fgRead + bgRead; }
+    uint64_t sumRead() const { return fgRead + bgRead; }
+
+    uint64_t sumFsync() const { return fgFsync + bgFsync; }
 
     void reset() {
         uid = 0;
@@ -103,6 +154,65 @@ struct UserIo {
     }
 };
 
+// Parse /proc/uid_io/stats into |out|, in the order of the file
+void parseUidIoStats(std::string_view text, std::vector<UserIo> *out);
+
+enum IoRankKey {
+    IO_RANK_READ = 0,
+    IO_RANK_WRITE,
+    IO_RANK_FSYNC,
+    IO_RANK_FG_READ,
+    IO_RANK_BG_READ,
+    IO_RANK_FG_WRITE,
+    IO_RANK_BG_WRITE,
+    IO_RANK_MAX,
+};
+
+inline uint64_t rankValue(const UserIo &usage, IoRankKey key) {
+    switch (key) {
+        case IO_RANK_READ:
+            return usage.sumRead();
+        case IO_RANK_WRITE:
+            return usage.sumWrite();
+        case IO_RANK_FSYNC:
+            return usage.sumFsync();
+        case IO_RANK_FG_READ:
+            return usage.fgRead;
+        case IO_RANK_BG_READ:
+            return usage.bgRead;
+        case IO_RANK_FG_WRITE:
+            return usage.fgWrite;
+        case IO_RANK_BG_WRITE:
+            return usage.bgWrite;
+        default:
+            return 0;
+    }
+}
+
+/*
+ * IoTopRanker - keeps the top K UIDs for one IoRankKey
+ *
+ * A bounded min-heap: offer() is O(1) for UIDs below the current K-th entry
+ * and O(log K) otherwise. UIDs with zero value for the key are never ranked.
+ */
+class IoTopRanker {
+  private:
+    IoRankKey mKey;
+    size_t mCount = IO_TOP_MAX;
+    std::vector<UserIo> mTop;
+    bool heapLess(const UserIo &a, const UserIo &b) const {
+        return rankValue(a, mKey) > rankValue(b, mKey);
+    }
+
+  public:
+    IoTopRanker(IoRankKey key) : mKey(key) {}
+    IoRankKey key() const { return mKey; }
+    void reset(size_t count);
+    void offer(const UserIo &usage);
+    // Sorts the selection in descending order; call once after the last offer()
+    const std::vector<UserIo> &finish();
+};
+
 class ScopeTimer {
   private:
     bool mDisabled;
@@ -125,47 +235,195 @@ class ScopeTimer {
     void dump(std::string *outAppend);
 };
 
+#define IO_BURST_WINDOW_BUCKETS 30  // one bucket per refresh
+#define IO_BURST_MAX_UIDS 64
+constexpr uint64_t IO_BURST_DEFAULT_RATE = 20L * 1000L * 1000L;  // 20MB/s
+constexpr uint32_t IO_BURST_DEFAULT_DURATION = 30;                // seconds
+
+/*
+ * IoBurstDetector - sliding window of per UID IO rate
+ *
+ * A fixed table of IO_BURST_MAX_UIDS slots, each a ring of per-refresh byte
+ * counts with a running sum, so updates are O(1) and memory does not depend on
+ * how many UIDs exist. A UID gets a slot once it goes over the burst rate;
+ * the quietest idle slot is recycled when the table is full. A burst is
+ * reported once the rate stays over the limit for the minimum duration, and
+ * again when it ends.
+ */
+class IoBurstDetector {
+  public:
+    struct Event {
+        uint32_t uid;
+        bool ended;
+        uint64_t bytes;       // during the burst
+        uint64_t durationMs;  // of the burst so far
+        uint64_t windowBytes;
+        uint64_t windowMs;
+    };
+    void setRate(uint64_t bytesPerSec) { mRate = bytesPerSec; }
+    void setDuration(uint32_t seconds) { mDurationMs = seconds * 1000ULL; }
+    // |diffs| must be sorted by uid
+    void update(const std::vector<UserIo> &diffs, uint64_t intervalMs);
+    const std::vector<Event> &events() const { return mEvents; }
+
+  private:
+    struct Slot {
+        bool used = false;
+        uint32_t uid = 0;
+        uint64_t buckets[IO_BURST_WINDOW_BUCKETS] = {};
+        uint64_t sum = 0;  // of buckets
+        uint64_t lastTick = 0;
+        uint64_t burstBytes = 0;
+        uint64_t burstMs = 0;  // consecutive time over the rate
+        bool reported = false;
+    };
+    uint64_t mRate = IO_BURST_DEFAULT_RATE;
+    uint64_t mDurationMs = IO_BURST_DEFAULT_DURATION * 1000ULL;
+    uint64_t mTick = 0;
+    uint64_t mBucketMs[IO_BURST_WINDOW_BUCKETS] = {};
+    uint64_t mWindowMs = 0;
+    Slot mSlots[IO_BURST_MAX_UIDS];
+    std::vector<Slot *> mByUid;  // used slots, sorted by uid
+    std::vector<Event> mEvents;
+    void advance(Slot *slot);
+    static bool slotUidLess(const Slot *slot, uint32_t uid) { return slot->uid < uid; }
+    Slot *findSlot(uint32_t uid);
+    Slot *allocSlot(uint32_t uid);
+    void record(Slot *slot, uint64_t bytes, uint64_t intervalMs);
+};
+
 constexpr uint64_t IO_USAGE_DUMP_THRESHOLD = 50L * 1000L * 1000L;  // 50MB
 class IoStats {
   private:
     uint64_t mMinSizeOfTotalRead = IO_USAGE_DUMP_THRESHOLD;
     uint64_t mMinSizeOfTotalWrite = IO_USAGE_DUMP_THRESHOLD;
-    std::chrono::system_clock::time_point mLast;
-    std::chrono::system_clock::time_point mNow;
-    std::unordered_map<uint32_t, UserIo> mPrevious;
+    // Awake time, so rates exclude suspend
+    std::chrono::steady_clock::time_point mLast;
+    std::chrono::steady_clock::time_point mNow;
+    std::vector<UserIo> mPrevious;  // last raw table, sorted by uid
+    std::vector<UserIo> mDiffs;     // increments of this tick, sorted by uid
     UserIo mTotal;
-    UserIo mWriteTop[IO_TOP_MAX];
-    UserIo mReadTop[IO_TOP_MAX];
-    std::vector<uint32_t> mUnknownUidList;
-    std::unordered_map<uint32_t, std::string> mUidNameMap;
-    ProcPidIoStats mProcIoStats;
+    // setOptions() arrives on a binder thread; mRankersMutex guards the ranking
+    // setup against the refresh that iterates it.
+    std::mutex mRankersMutex;
+    uint32_t mTopCount = IO_TOP_MAX;
+    std::vector<IoTopRanker> mRankers;
+    UidNameCache mUidNames;
+    IoBurstDetector mBursts;
+    EwmaBaseline mBaseline;  // of read + write MB per interval
+    bool mAnomaly = false;
+    float mBaselineMean = 0.0f;
+    float mBaselineStddev = 0.0f;
     // Functions
-    std::unordered_map<uint32_t, UserIo> calcIncrement(
-        const std::unordered_map<uint32_t, UserIo> &data);
-    void updateTopWrite(UserIo usage);
-    void updateTopRead(UserIo usage);
-    void updateUnknownUidList();
+    void calcIncrement(const std::vector<UserIo> &data);
+    void dumpTop(IoTopRanker &ranker, bool force, std::stringstream &out);
 
   public:
-    IoStats() {
-        mNow = std::chrono::system_clock::now();
+    IoStats(const sp<ProcSnapshot> &snapshot)
+        : mUidNames(snapshot), mBaseline(IO_ANOMALY_MIN_DEVIATION) {
+        mNow = std::chrono::steady_clock::now();
         mLast = mNow;
+        setRankKeys(IO_RANK_DEFAULT);
     }
-    void calcAll(std::unordered_map<uint32_t, UserIo> &&data);
+    // |data| is swapped with the previous table and must be refilled by the caller.
+    // Returns false on the first call, which only primes the previous table.
+    bool calcAll(std::vector<UserIo> *data);
+    const UserIo &getTotal() const { return mTotal; }
     void setDumpThresholdSizeForRead(uint64_t size) { mMinSizeOfTotalRead = size; }
     void setDumpThresholdSizeForWrite(uint64_t size) { mMinSizeOfTotalWrite = size; }
+    void setTopCount(uint32_t count) {
+        std::lock_guard<std::mutex> lock(mRankersMutex);
+        mTopCount = count;
+    }
+    void setBurstRate(uint64_t bytesPerSec) { mBursts.setRate(bytesPerSec); }
+    void setBurstDuration(uint32_t seconds) { mBursts.setDuration(seconds); }
+    void setAnomalySigma(uint32_t sigma) { mBaseline.setSigma(sigma); }
+    void setScanBudget(uint32_t pids, uint32_t us) { mUidNames.setScanBudget(pids, us); }
+    // |keys| is a comma separated list of read,write,fsync,fgread,bgread,fgwrite,bgwrite
+    bool setRankKeys(const std::string &keys);
     bool dump(std::stringstream *output);
+    // Top |count| writers of the last interval as <uid, name, bytes>
+    void getTopWriters(size_t count,
+                       std::vector<std::tuple<uint32_t, std::string, uint64_t>> *out);
+};
+
+struct PidIo {
+    uint32_t pid;
+    uint32_t uid;
+    uint64_t starttime;  // with pid, identifies one process lifetime
+    uint64_t rchar;
+    uint64_t wchar;
+    uint64_t readBytes;
+    uint64_t writeBytes;
+    uint64_t cancelledWriteBytes;
+    char name[16];  // comm, TASK_COMM_LEN
+
+    uint64_t sumBytes() const { return readBytes + writeBytes; }
+};
+
+/*
+ * PidIoStats - per process IO for UIDs shared by many native daemons
+ *
+ * UID level stats fold every process running as e.g. root or system into one
+ * row. For the configured UIDs this reads /proc/<pid>/io and reports the top
+ * processes. Tables are flat vectors sorted by pid; a process only matches
+ * its previous sample when the starttime also matches.
+ */
+class PidIoStats {
+  private:
+    sp<ProcSnapshot> mProcSnapshot;
+    // setUids() arrives on a binder thread while refresh() walks the tables
+    std::mutex mUidsMutex;
+    std::vector<uint32_t> mUids;      // sorted
+    bool mPrimed = false;             // mPrevious holds a sample of mUids
+    uint64_t mLastTick = 0;           // clock ticks since boot at the last refresh
+    std::vector<PidIo> mPrevious;     // sorted by pid
+    std::vector<PidIo> mCurrent;      // sorted by pid
+    std::vector<PidIo> mDiffs;
+    std::string mBuffer;
+    uint32_t mTopCount = IO_TOP_MAX;
+    bool readPid(uint32_t pid, PidIo *io);
+
+  public:
+    PidIoStats(const sp<ProcSnapshot> &snapshot) : mProcSnapshot(snapshot) {}
+    // |uids| is a comma separated uid list; empty disables the drill down
+    bool setUids(const std::string &uids);
+    void setTopCount(uint32_t count) { mTopCount = count; }
+    void refresh();
+    void dump(std::stringstream *output);
 };
 
 class IoUsage : public StatsType {
   private:
     bool mDisabled;
     IoStats mStats;
+    PidIoStats mPidStats;
+    std::string mBuffer;         // raw /proc/uid_io/stats, reused across ticks
+    std::vector<UserIo> mUidIo;  // parsed rows, reused across ticks
+    uint32_t mScanPids = 0;      // iostats.scan.pids
+    uint32_t mScanUs = 0;        // iostats.scan.us
+    size_t mReadHistogram;       // bytes per tick
+    size_t mWriteHistogram;
+    std::chrono::steady_clock::time_point mDiffTick;  // tick of the latest diffs
 
   public:
-    IoUsage() : mDisabled(false) {}
+    IoUsage(const sp<ProcSnapshot> &snapshot)
+        : mDisabled(false), mStats(snapshot), mPidStats(snapshot) {
+        setMetricNames({"read_mb", "write_mb", "fsync"});
+        mReadHistogram = addHistogram("read", "KB", 1024.0);
+        mWriteHistogram = addHistogram("write", "KB", 1024.0);
+    }
     void refresh(void);
     void setOptions(const std::string &key, const std::string &value);
+    // For collectors that correlate with IO usage within the same tick; false
+    // unless IO usage was diffed in |tick|
+    bool getTopWriters(std::chrono::steady_clock::time_point tick, size_t count,
+                       std::vector<std::tuple<uint32_t, std::string, uint64_t>> *out) {
+        if (mDisabled || mDiffTick != tick)
+            return false;
+        mStats.getTopWriters(count, out);
+        return true;
+    }
 };
 
 }  // namespace perfstatsd
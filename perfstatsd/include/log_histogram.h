@@ -0,0 +1,65 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _LOG_HISTOGRAM_H_
+#define _LOG_HISTOGRAM_H_
+
+#include <string>
+
+#define HISTOGRAM_WINDOW (6 * 30)  // samples, same span as the sample buffers
+// Values below 2^HISTOGRAM_SUB_BITS get a bucket each; above that every power
+// of two is split into 2^(HISTOGRAM_SUB_BITS - 1) buckets, ~3% relative error.
+#define HISTOGRAM_SUB_BITS (6)
+#define HISTOGRAM_BUCKETS ((64 - HISTOGRAM_SUB_BITS + 2) << (HISTOGRAM_SUB_BITS - 1))
+
+namespace android {
+namespace pixel {
+namespace perfstatsd {
+
+/*
+ * LogHistogram - percentiles over the last HISTOGRAM_WINDOW samples
+ *
+ * A ring of bucket indices remembers which bucket each sample in the window
+ * went to, so add() evicts the oldest sample with one decrement. add() is
+ * O(1) and allocation free; only percentile queries walk the buckets.
+ */
+class LogHistogram {
+  public:
+    // Values are printed as value / |divisor| with |unit|
+    LogHistogram(const std::string &name, const char *unit, double divisor);
+    void add(uint64_t value);
+    uint64_t percentile(double p) const;
+    uint64_t max() const;
+    size_t count() const { return mCount; }
+    void summary(const std::string &collector, std::string *out) const;
+
+  private:
+    std::string mName;
+    const char *mUnit;
+    double mDivisor;
+    uint16_t mCounts[HISTOGRAM_BUCKETS];
+    uint16_t mRing[HISTOGRAM_WINDOW];  // bucket of each sample in the window
+    size_t mHead;                      // next ring slot to write
+    size_t mCount;
+    static uint16_t bucketOf(uint64_t value);
+    static uint64_t upperBound(uint16_t bucket);
+};
+
+}  // namespace perfstatsd
+}  // namespace pixel
+}  // namespace android
+
+#endif /* _LOG_HISTOGRAM_H_ */
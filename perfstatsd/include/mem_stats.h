@@ -0,0 +1,92 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _MEM_STATS_H_
+#define _MEM_STATS_H_
+
+#include <proc_snapshot.h>
+#include <statstype.h>
+#include <unordered_map>
+
+#define MEM_STATS_BUFFER_SIZE (6 * 30)
+#define MEM_TOP_DEFAULT (5)
+#define MEM_RSS_THRESHOLD_DEFAULT (4096)  // KB of RSS change before PSS is re-read
+#define MEM_TREND_SAMPLES (30)
+
+#define MEMSTATS_TOPCOUNT "memstats.topcount"
+#define MEMSTATS_RSS_THRESHOLD "memstats.rss.threshold"
+#define MEMSTATS_DISABLED "memstats.disabled"
+#define MEMSTATS_DEBUG "memstats.debug"
+
+namespace android {
+namespace pixel {
+namespace perfstatsd {
+
+// Fields of /proc/<pid>/smaps_rollup, in KB
+struct MemRollup {
+    uint64_t rss;
+    uint64_t pss;
+    uint64_t pssAnon;
+    uint64_t pssFile;
+    uint64_t pssShmem;
+    uint64_t swapPss;
+};
+
+struct MemProc {
+    uint64_t starttime;  // with the pid, identifies one process lifetime
+    uint64_t readRss;    // RSS KB when the rollup was last read
+    bool rollupFailed;   // smaps_rollup unreadable, only RSS is listed
+    MemRollup rollup;
+    // PSS samples for the growth trend, a ring of MEM_TREND_SAMPLES
+    int64_t trendMs[MEM_TREND_SAMPLES];
+    uint64_t trendPss[MEM_TREND_SAMPLES];
+    size_t trendHead;
+    size_t trendCount;
+};
+
+/*
+ * MemStats - PSS attribution of the largest processes
+ *
+ * RSS of every process comes for free with the /proc/<pid>/stat of the tick.
+ * The top ones by RSS get their smaps_rollup read, which is expensive, so it
+ * is re-read only after RSS moved by more than the threshold. PSS samples of
+ * each process are kept to report its growth rate over the window.
+ */
+class MemStats : public StatsType {
+  public:
+    MemStats(const sp<ProcSnapshot> &snapshot);
+    void refresh(void);
+    void setOptions(const std::string &key, const std::string &value);
+
+  private:
+    sp<ProcSnapshot> mProcSnapshot;
+    std::chrono::steady_clock::time_point mStart;  // trend time base, awake time
+    bool mDisabled;
+    uint32_t mTopCount;
+    uint64_t mRssThreshold;
+    uint64_t mPageKb;
+    std::string mBuffer;
+    std::vector<std::pair<uint64_t, uint32_t>> mRss;  // <rss KB, pid>
+    std::unordered_map<uint32_t, MemProc> mProcs;
+    bool readRollup(uint32_t pid, MemRollup *rollup);
+    float trend(const MemProc &proc) const;
+};
+
+}  // namespace perfstatsd
+}  // namespace pixel
+}  // namespace android
+
+#endif /*  _MEM_STATS_H_ */
@@ -0,0 +1,94 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _METRIC_ARCHIVE_H_
+#define _METRIC_ARCHIVE_H_
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+// Tier 0 is the raw sample buffer of each collector; these are the aggregates
+#define ARCHIVE_TIER_RAW (0)
+#define ARCHIVE_TIER_1MIN (1)   // 1 min buckets for 24 h
+#define ARCHIVE_TIER_10MIN (2)  // 10 min buckets for 7 days
+#define ARCHIVE_TIER_MAX (3)
+
+namespace android {
+namespace pixel {
+namespace perfstatsd {
+
+struct MetricAggregate {
+    float min;
+    float max;
+    float sum;
+    uint32_t count;
+
+    void reset() {
+        min = 0.0f;
+        max = 0.0f;
+        sum = 0.0f;
+        count = 0;
+    }
+    void add(float value) {
+        if (count == 0 || value < min)
+            min = value;
+        if (count == 0 || value > max)
+            max = value;
+        sum += value;
+        count++;
+    }
+    float avg() const { return count ? sum / count : 0.0f; }
+};
+
+/*
+ * MetricArchive - round robin archive of numeric samples
+ *
+ * Every tier is a fixed size ring of min/avg/max buckets. add() folds a
+ * sample into the open bucket of each tier and closes the bucket when the
+ * sample falls into the next time step, so nothing is recomputed on dump.
+ */
+class MetricArchive {
+  public:
+    void setMetrics(const std::vector<std::string> &names);
+    size_t metricCount() const { return mNames.size(); }
+    // |values| holds one value per metric
+    void add(std::chrono::system_clock::time_point time, const float *values);
+    void dump(int tier, std::string *out) const;
+
+  private:
+    struct Tier {
+        std::chrono::seconds step;
+        size_t slots;
+        std::vector<std::chrono::system_clock::time_point> times;  // bucket start
+        std::vector<MetricAggregate> buckets;                      // slots x metrics
+        size_t head = 0;  // next slot to write
+        size_t count = 0;
+        std::chrono::system_clock::time_point openStart;
+        std::vector<MetricAggregate> open;  // bucket being filled
+    };
+    std::vector<std::string> mNames;
+    Tier mTiers[ARCHIVE_TIER_MAX];
+    void close(Tier *tier);
+    void dumpBucket(std::chrono::system_clock::time_point time, const MetricAggregate *buckets,
+                    std::string *out) const;
+};
+
+}  // namespace perfstatsd
+}  // namespace pixel
+}  // namespace android
+
+#endif /* _METRIC_ARCHIVE_H_ */
@@ -0,0 +1,72 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _NET_STATS_H_
+#define _NET_STATS_H_
+
+#include <android-base/unique_fd.h>
+#include <net/if.h>
+#include <statstype.h>
+
+#define NET_STATS_BUFFER_SIZE (6 * 30)
+
+#define NETSTATS_DISABLED "netstats.disabled"
+#define NETSTATS_DEBUG "netstats.debug"
+
+namespace android {
+namespace pixel {
+namespace perfstatsd {
+
+struct NetIface {
+    char name[IFNAMSIZ];
+    uint64_t rxBytes;
+    uint64_t rxPackets;
+    uint64_t rxDrops;
+    uint64_t txBytes;
+    uint64_t txPackets;
+    uint64_t txDrops;
+};
+
+/*
+ * NetStats - throughput per network interface from /proc/net/dev
+ *
+ * Interfaces come and go (rmnet, wlan, tun); each tick is parsed into a
+ * table sorted by name and merge-joined with the previous one, so an
+ * interface shows up from its second sample and is dropped once it's gone.
+ */
+class NetStats : public StatsType {
+  public:
+    NetStats(void);
+    void refresh(void);
+    void setOptions(const std::string &key, const std::string &value);
+    // Parse /proc/net/dev into |out|, sorted by name
+    static void parseNetDev(std::string_view text, std::vector<NetIface> *out);
+
+  private:
+    std::chrono::steady_clock::time_point mLast;  // awake time, excludes suspend
+    bool mDisabled;
+    android::base::unique_fd mFd;
+    std::string mBuffer;
+    std::vector<NetIface> mCurrent;   // sorted by name
+    std::vector<NetIface> mPrevious;  // sorted by name
+    bool readStats(void);
+};
+
+}  // namespace perfstatsd
+}  // namespace pixel
+}  // namespace android
+
+#endif /*  _NET_STATS_H_ */
@@ -17,28 +17,95 @@
 #ifndef _PERFSTATSD_H_
 #define _PERFSTATSD_H_
 
+#include "collector_registry.h"
 #include "cpu_usage.h"
+#include "disk_stats.h"
+#include "f2fs_stats.h"
 #include "io_usage.h"
+#include "proc_snapshot.h"
+#include "sampler.h"
 #include "statstype.h"
 
+#include <utils/Errors.h>
+#include <deque>
+
 #define DEFAULT_DATA_COLLECT_PERIOD (10)  // seconds
+#define SUBSCRIBER_QUEUE_MAX (64)         // samples kept for a slow subscriber
+#define EVENT_LOG_BUFFER_SIZE (6 * 30)
+#define PERFSTATSD_CONFIG_PATH "/vendor/etc/perfstatsd.conf"
 #define PERFSTATSD_PERIOD "perfstatsd.period"
+#define PERFSTATSD_COLLECTORS "perfstatsd.collectors"
+#define PERFSTATSD_COLLECTORS_DEFAULT "cpu,io"  // the others are opt-in
+// Per collector, e.g. "io.period"
+#define COLLECTOR_PERIOD_SUFFIX ".period"
+#define COLLECTOR_BUFFER_SUFFIX ".buffer"
 
 namespace android {
 namespace pixel {
 namespace perfstatsd {
 
+/*
+ * SampleSink - receiver of streamed samples
+ *
+ * deliver() returns OK when the batch was taken, DEAD_OBJECT when the client
+ * is gone, and any other error when the client is busy and the batch should
+ * be retried with the next one.
+ */
+class SampleSink : public virtual RefBase {
+  public:
+    virtual status_t deliver(const std::vector<std::string> &samples, uint32_t dropped) = 0;
+    // Identifies the client, for unsubscribe()
+    virtual const void *token() const = 0;
+    // Called once the sink is dropped, to release what it holds on the client
+    virtual void detach() {}
+};
+
+// Records of perfstatsd itself, such as suspend gaps, kept next to the samples
+class EventLog : public StatsType {
+  public:
+    void refresh(void) {}
+    void setOptions(const std::string &, const std::string &) {}
+    void record(std::string &content) { append(content); }
+};
+
 class Perfstatsd : public RefBase {
   private:
-    std::list<std::unique_ptr<StatsType>> mStats;
+    struct Subscriber {
+        sp<SampleSink> sink;
+        std::vector<std::string> collectors;  // empty for all
+        std::deque<std::string> pending;
+        uint32_t dropped;
+    };
+    std::mutex mStatsMutex;                        // taken before mSubscribersMutex
+    std::list<std::unique_ptr<StatsType>> mStats;  // in registry order
+    sp<ProcSnapshot> mProcSnapshot;
     uint32_t mRefreshPeriod;
+    Sampler mSampler;
+    std::unique_ptr<EventLog> mEvents;
+    std::mutex mSubscribersMutex;
+    std::list<Subscriber> mSubscribers;
+    std::vector<StatsData> mNewSamples;
+    void publish(void);
+    void collectNewSamples(StatsType *stats);
+    void loadConfig(const char *path);
+    void setCollectors(const std::string &names);
+    StatsType *findStats(const std::string &name);
+    bool setCollectorOption(const std::string &key, const std::string &value);
 
   public:
     Perfstatsd(void);
     void refresh(void);
-    void pause(void) { sleep(mRefreshPeriod); }
+    // Waits for the next tick in awake time and notes any suspend in between
+    void pause(void);
     void getHistory(std::string *ret);
+    // |tier| is one of ARCHIVE_TIER_*; ARCHIVE_TIER_RAW is the same as getHistory()
+    void getHistory(int tier, std::string *ret);
+    // Percentiles over the sample window, also the head of getHistory()
+    void getSummary(std::string *ret);
     void setOptions(const std::string &key, const std::string &value);
+    // |collectors| is a comma separated list of collector names; empty for all
+    void subscribe(const sp<SampleSink> &sink, const std::string &collectors);
+    void unsubscribe(const void *token);
 };
 
 }  // namespace perfstatsd
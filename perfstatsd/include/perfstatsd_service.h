@@ -20,6 +20,7 @@
 #include <binder/BinderService.h>
 #include <binder/IPCThreadState.h>
 #include <binder/ProcessState.h>
+#include "android/pixel/perfstatsd/BnPerfstatsdCallback.h"
 #include "android/pixel/perfstatsd/BnPerfstatsdPrivate.h"
 
 using namespace android::pixel::perfstatsd;
@@ -33,7 +34,12 @@ class PerfstatsdPrivateService : public android::BinderService<PerfstatsdPrivate
     static char const *getServiceName() { return "perfstatsd_pri"; }
 
     android::binder::Status dumpHistory(std::string *_aidl_return);
+    android::binder::Status dumpHistoryTier(int32_t tier, std::string *_aidl_return);
+    android::binder::Status dumpSummary(std::string *_aidl_return);
     android::binder::Status setOptions(const std::string &key, const std::string &value);
+    android::binder::Status registerCallback(const android::sp<IPerfstatsdCallback> &callback,
+                                             const std::string &collectors);
+    android::binder::Status unregisterCallback(const android::sp<IPerfstatsdCallback> &callback);
 };
 
 android::sp<IPerfstatsdPrivate> getPerfstatsdPrivateService();
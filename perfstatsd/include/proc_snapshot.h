@@ -0,0 +1,87 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _PROC_SNAPSHOT_H_
+#define _PROC_SNAPSHOT_H_
+
+#include <perfstats_buffer.h>
+
+#define PROC_DENTS_BUFFER_SIZE (32 * 1024)
+#define PROC_CMDLINE_MAX (128)
+
+namespace android {
+namespace pixel {
+namespace perfstatsd {
+
+// What a process is, filled once per lifetime; (pid, starttime) is never reused
+struct ProcIdentity {
+    uint32_t pid;
+    uint64_t starttime;   // clock ticks after boot, field 22 of stat
+    uint32_t uid;         // real uid
+    std::string comm;
+    std::string cmdline;  // arguments joined by spaces, at most PROC_CMDLINE_MAX
+    std::string cgroup;   // cpuset group, or the cgroup v2 path without cpuset
+};
+
+struct ProcEntry {
+    uint32_t pid;
+    uint32_t cached;  // PROC_FIELD_* bits already read in this tick
+    std::string stat;
+    std::string status;
+    ProcIdentity *identity;  // valid with PROC_FIELD_IDENTITY
+};
+
+/*
+ * ProcSnapshot - one view of /proc shared by all collectors within a tick
+ *
+ * The pid list is built at most once per tick with getdents64() into a reused
+ * buffer. Per-pid files are read on first access and memoized until the next
+ * invalidate(), so collectors reading the same file do not hit procfs twice
+ * and all of them see the same pid set. The identity of a process is kept
+ * across ticks until it exits or its pid is reused.
+ */
+class ProcSnapshot : public RefBase {
+  public:
+    ProcSnapshot(void);
+    // Drop the cached pid list and per-pid fields; called once per tick.
+    void invalidate(void);
+    // Sorted pid list of the current tick.
+    const std::vector<uint32_t> &getPids(void);
+    // Content of /proc/<pid>/stat, or nullptr when the process is gone.
+    const std::string *getStat(uint32_t pid);
+    // Content of /proc/<pid>/status, or nullptr when the process is gone.
+    const std::string *getStatus(uint32_t pid);
+    // Identity of the process now running as |pid|, or nullptr when it's gone.
+    const ProcIdentity *getIdentity(uint32_t pid);
+
+  private:
+    bool mScanned;
+    std::vector<char> mDents;
+    std::vector<uint32_t> mPids;
+    std::vector<ProcEntry> mEntries;  // parallel to mPids
+    std::unordered_map<uint32_t, ProcIdentity> mIdentities;
+    std::string mBuffer;
+    void scan(void);
+    ProcEntry *findEntry(uint32_t pid);
+    const std::string *readField(uint32_t pid, uint32_t field);
+    bool fillIdentity(const std::string &stat, ProcIdentity *identity);
+};
+
+}  // namespace perfstatsd
+}  // namespace pixel
+}  // namespace android
+
+#endif /* _PROC_SNAPSHOT_H_ */
@@ -0,0 +1,57 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _SAMPLER_H_
+#define _SAMPLER_H_
+
+#include <android-base/unique_fd.h>
+#include <chrono>
+
+#define SUSPEND_MIN_MS (1000)  // shorter gaps are scheduling noise
+
+namespace android {
+namespace pixel {
+namespace perfstatsd {
+
+/*
+ * Sampler - paces perfstatsd ticks in awake time
+ *
+ * Ticks come from a CLOCK_MONOTONIC timerfd, which stops while the device is
+ * suspended, so a sample never wakes the AP. Comparing CLOCK_BOOTTIME with
+ * CLOCK_MONOTONIC across ticks tells how long the device slept in between.
+ */
+class Sampler {
+  public:
+    Sampler(void);
+    // Blocks until |period| seconds of awake time after the previous tick
+    void wait(uint32_t period);
+    // Time spent suspended between the previous two ticks
+    std::chrono::milliseconds suspended(void) const { return mSuspended; }
+
+  private:
+    android::base::unique_fd mTimerFd;
+    uint32_t mArmedPeriod;
+    std::chrono::nanoseconds mLastBoottime;
+    std::chrono::nanoseconds mLastMonotonic;
+    std::chrono::milliseconds mSuspended;
+    bool arm(uint32_t period);
+};
+
+}  // namespace perfstatsd
+}  // namespace pixel
+}  // namespace android
+
+#endif /* _SAMPLER_H_ */
@@ -17,6 +17,8 @@
 #ifndef _STATSTYPE_H_
 #define _STATSTYPE_H_
 
+#include <log_histogram.h>
+#include <metric_archive.h>
 #include <perfstats_buffer.h>
 
 namespace android {
@@ -38,10 +40,58 @@ class StatsType : public RefBase {
     size_t bufferSize() { return mBuffer.size(); }
     void setBufferSize(size_t size) { mBuffer.setSize(size); }
     size_t bufferCount() { return mBuffer.count(); }
+    const std::string &getName() const { return mName; }
+    void setName(const std::string &name) { mName = name; }
+    // Seconds between refreshes; 0 to refresh on every perfstatsd tick
+    void setPeriod(uint32_t seconds) { mPeriod = std::chrono::seconds(seconds); }
+    // Inactive collectors keep their history but are not refreshed
+    void setActive(bool active) { mActive = active; }
+    bool isActive() const { return mActive; }
+    // Whether to refresh at |now|; |slack| absorbs the jitter of the tick
+    bool due(std::chrono::steady_clock::time_point now, std::chrono::milliseconds slack) {
+        if (!mActive || now + slack < mNextRefresh)
+            return false;
+        mNextRefresh = now + mPeriod;
+        mTick = now;
+        return true;
+    }
+    // The perfstatsd tick of the latest refresh, shared by all collectors due in it
+    std::chrono::steady_clock::time_point tick() const { return mTick; }
+    // While streaming, appended samples are also kept until takeNewSamples()
+    void setStreaming(bool streaming) {
+        std::unique_lock<std::mutex> mlock(mMutex);
+        mStreaming = streaming;
+        if (!streaming)
+            mNewSamples.clear();
+    }
+    void dumpArchive(int tier, std::string *out) {
+        std::unique_lock<std::mutex> mlock(mMutex);
+        mArchive.dump(tier, out);
+    }
+    bool hasMetrics() const { return mArchive.metricCount() > 0; }
+    // p50/p90/p99/max of every histogram over the sample window
+    void dumpSummary(std::string *out) {
+        std::unique_lock<std::mutex> mlock(mMutex);
+        for (const auto &histogram : mHistograms) {
+            histogram->summary(mName, out);
+        }
+        mLatency.summary(mName, out);
+    }
+    void recordLatency(std::chrono::microseconds latency) {
+        std::unique_lock<std::mutex> mlock(mMutex);
+        mLatency.add(latency.count());
+    }
+    void takeNewSamples(std::vector<StatsData> *out) {
+        std::unique_lock<std::mutex> mlock(mMutex);
+        out->insert(out->end(), mNewSamples.begin(), mNewSamples.end());
+        mNewSamples.clear();
+    }
 
   protected:
     void append(StatsData &&data) {
         std::unique_lock<std::mutex> mlock(mMutex);
+        if (mStreaming)
+            mNewSamples.push_back(data);
         mBuffer.emplace(std::forward<StatsData>(data));
     }
     void append(std::chrono::system_clock::time_point &time, std::string &content) {
@@ -54,9 +104,38 @@ class StatsType : public RefBase {
         std::chrono::system_clock::time_point now = std::chrono::system_clock::now();
         append(now, content);
     }
+    // Numeric view of the samples, kept in the long-horizon archive
+    void setMetricNames(const std::vector<std::string> &names) {
+        std::unique_lock<std::mutex> mlock(mMutex);
+        mArchive.setMetrics(names);
+    }
+    void appendMetrics(std::chrono::system_clock::time_point &time, const float *values) {
+        std::unique_lock<std::mutex> mlock(mMutex);
+        mArchive.add(time, values);
+    }
+    // Returns the id to record() values with; |divisor| scales values for display
+    size_t addHistogram(const std::string &name, const char *unit, double divisor) {
+        std::unique_lock<std::mutex> mlock(mMutex);
+        mHistograms.emplace_back(new LogHistogram(name, unit, divisor));
+        return mHistograms.size() - 1;
+    }
+    void record(size_t histogram, uint64_t value) {
+        std::unique_lock<std::mutex> mlock(mMutex);
+        mHistograms[histogram]->add(value);
+    }
 
   private:
+    std::string mName;
+    std::chrono::seconds mPeriod{0};
+    std::chrono::steady_clock::time_point mNextRefresh;
+    std::chrono::steady_clock::time_point mTick;
+    bool mActive = true;
     PerfstatsBuffer mBuffer;
+    bool mStreaming = false;
+    std::vector<StatsData> mNewSamples;
+    MetricArchive mArchive;
+    std::vector<std::unique_ptr<LogHistogram>> mHistograms;
+    LogHistogram mLatency{"latency", "ms", 1000.0};  // of refresh(), in us
     std::mutex mMutex;
 };
 
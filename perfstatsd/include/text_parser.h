@@ -0,0 +1,120 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _TEXT_PARSER_H_
+#define _TEXT_PARSER_H_
+
+#include <charconv>
+#include <string>
+#include <string_view>
+
+namespace android {
+namespace pixel {
+namespace perfstatsd {
+
+/*
+ * Read the whole file into |buf|. The capacity of |buf| is kept between calls,
+ * so polling the same file does not allocate in steady state.
+ */
+bool readFileToBuffer(const char *path, std::string *buf);
+bool readFdToBuffer(int fd, std::string *buf);
+
+/*
+ * TextScanner - in-place tokenizer over procfs/sysfs text
+ *
+ * Nothing is copied: tokens are string_views into the scanned buffer and
+ * integers are parsed with std::from_chars.
+ */
+class TextScanner {
+  public:
+    TextScanner(std::string_view text) : mPos(text.data()), mEnd(text.data() + text.size()) {}
+
+    bool atEnd() const { return mPos >= mEnd; }
+    bool atEol() const { return mPos >= mEnd || *mPos == '\n'; }
+
+    // Skip the remainder of the current line, including '\n'
+    void nextLine() {
+        while (mPos < mEnd && *mPos != '\n') mPos++;
+        if (mPos < mEnd)
+            mPos++;
+    }
+
+    // Skip blanks (but not newlines)
+    void skipSpaces() {
+        while (mPos < mEnd && (*mPos == ' ' || *mPos == '\t')) mPos++;
+    }
+
+    // Next blank separated token on the current line
+    bool token(std::string_view *out) {
+        skipSpaces();
+        const char *start = mPos;
+        while (mPos < mEnd && *mPos != ' ' && *mPos != '\t' && *mPos != '\n') mPos++;
+        *out = std::string_view(start, mPos - start);
+        return mPos != start;
+    }
+
+    bool skipToken() {
+        std::string_view unused;
+        return token(&unused);
+    }
+
+    template <typename T>
+    bool parseUint(T *out) {
+        skipSpaces();
+        auto result = std::from_chars(mPos, mEnd, *out);
+        if (result.ec != std::errc()) {
+            return false;
+        }
+        mPos = result.ptr;
+        return true;
+    }
+
+    // Consume |prefix| if the input continues with it
+    bool consume(std::string_view prefix) {
+        if (static_cast<size_t>(mEnd - mPos) < prefix.size() ||
+            std::string_view(mPos, prefix.size()) != prefix) {
+            return false;
+        }
+        mPos += prefix.size();
+        return true;
+    }
+
+    // Advance to just after the next |c| on the current line
+    bool skipPast(char c) {
+        while (mPos < mEnd && *mPos != '\n') {
+            if (*mPos++ == c)
+                return true;
+        }
+        return false;
+    }
+
+    // Rest of the current line, without '\n'; the cursor stays on the line
+    std::string_view restOfLine() const {
+        const char *e = mPos;
+        while (e < mEnd && *e != '\n') e++;
+        return std::string_view(mPos, e - mPos);
+    }
+
+  private:
+    const char *mPos;
+    const char *mEnd;
+};
+
+}  // namespace perfstatsd
+}  // namespace pixel
+}  // namespace android
+
+#endif /* _TEXT_PARSER_H_ */
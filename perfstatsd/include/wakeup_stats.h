@@ -0,0 +1,105 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _WAKEUP_STATS_H_
+#define _WAKEUP_STATS_H_
+
+#include <android-base/unique_fd.h>
+#include <statstype.h>
+#include <map>
+
+#define WAKEUP_STATS_BUFFER_SIZE (6 * 30)
+#define WAKEUP_TOP_DEFAULT (5)
+#define WAKEUP_RESCAN_TICKS (30)  // ticks between scans of /sys/class/wakeup
+
+#define WAKEUPSTATS_TOPCOUNT "wakeupstats.topcount"
+#define WAKEUPSTATS_DISABLED "wakeupstats.disabled"
+#define WAKEUPSTATS_DEBUG "wakeupstats.debug"
+
+namespace android {
+namespace pixel {
+namespace perfstatsd {
+
+enum WakeupCounter {
+    WAKEUP_TOTAL_TIME = 0,  // ms, including the active period in progress
+    WAKEUP_EVENT_COUNT,
+    WAKEUP_COUNTER_MAX,
+};
+
+enum SuspendCounter {
+    SUSPEND_SUCCESS = 0,
+    SUSPEND_FAIL,
+    SUSPEND_COUNTER_MAX,
+};
+
+struct WakeupSource {
+    std::string name;
+    // /sys/class/wakeup/<dir>/ node per counter; unused with debugfs
+    android::base::unique_fd fds[WAKEUP_COUNTER_MAX];
+    bool valid;    // prev holds a sample
+    bool present;  // seen by the last scan
+    uint64_t prev[WAKEUP_COUNTER_MAX];
+    uint64_t curr[WAKEUP_COUNTER_MAX];
+};
+
+struct WakeupDelta {
+    uint64_t heldMs;
+    uint64_t events;
+    const WakeupSource *source;
+};
+
+/*
+ * WakeupStats - who kept the device awake, per interval
+ *
+ * There can be hundreds of wakeup sources. The /sys/class/wakeup directory
+ * is indexed once and rescanned only every WAKEUP_RESCAN_TICKS, and the
+ * counter nodes of every source stay open for pread. Kernels without the
+ * class fall back to the debugfs wakeup_sources table.
+ */
+class WakeupStats : public StatsType {
+  public:
+    WakeupStats(void);
+    void refresh(void);
+    void setOptions(const std::string &key, const std::string &value);
+    // Parse the debugfs table into |sources| keyed by name; sources missing
+    // from it are dropped, new ones start without a sample
+    static void parseDebugfs(std::string_view text,
+                             std::map<std::string, WakeupSource, std::less<>> *sources);
+
+  private:
+    std::chrono::steady_clock::time_point mLast;  // awake time, excludes suspend
+    bool mDisabled;
+    bool mUseSysfs;
+    uint32_t mTopCount;
+    uint32_t mTicks;  // since the last scan
+    // Keyed by sysfs directory, or by name with debugfs
+    std::map<std::string, WakeupSource, std::less<>> mSources;
+    android::base::unique_fd mSuspendFds[SUSPEND_COUNTER_MAX];
+    bool mSuspendValid;
+    uint64_t mSuspendPrev[SUSPEND_COUNTER_MAX];
+    std::string mBuffer;
+    std::vector<WakeupDelta> mTop;
+    void scanSources(void);
+    void readSysfs(void);
+    void readDebugfs(void);
+    bool readSuspend(uint64_t *counters);
+};
+
+}  // namespace perfstatsd
+}  // namespace pixel
+}  // namespace android
+
+#endif /*  _WAKEUP_STATS_H_ */
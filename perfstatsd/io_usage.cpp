@@ -17,12 +17,16 @@
 #define LOG_TAG "perfstatsd_io"
 
 #include "io_usage.h"
+#include "text_parser.h"
 #include <android-base/parseint.h>
 #include <android-base/stringprintf.h>
 #include <android-base/strings.h>
 #include <cutils/android_filesystem_config.h>
 #include <inttypes.h>
 #include <pwd.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
 
 using namespace android::pixel::perfstatsd;
 static constexpr const char *UID_IO_STATS_PATH = "/proc/uid_io/stats";
@@ -30,12 +34,32 @@ static constexpr char FMT_STR_TOTAL_USAGE[] =
     "[IO_TOTAL: %lld.%03llds] RD:%s WR:%s fsync:%" PRIu64 "\n";
 static constexpr char STR_TOP_HEADER[] =
     "[IO_TOP    ]    fg bytes,    bg bytes,fgsyn,bgsyn :  UID   PKG_NAME\n";
-static constexpr char FMT_STR_TOP_WRITE_USAGE[] =
-    "[W%d:%6.2f%%]%12" PRIu64 ",%12" PRIu64 ",%5" PRIu64 ",%5" PRIu64 " :%6u %s\n";
-static constexpr char FMT_STR_TOP_READ_USAGE[] =
-    "[R%d:%6.2f%%]%12" PRIu64 ",%12" PRIu64 ",%5" PRIu64 ",%5" PRIu64 " :%6u %s\n";
-static constexpr char FMT_STR_SKIP_TOP_READ[] = "(< %" PRIu64 "MB)skip RD";
-static constexpr char FMT_STR_SKIP_TOP_WRITE[] = "(< %" PRIu64 "MB)skip WR";
+static constexpr char FMT_STR_TOP_USAGE[] =
+    "[%s%d:%6.2f%%]%12" PRIu64 ",%12" PRIu64 ",%5" PRIu64 ",%5" PRIu64 " :%6u %s\n";
+static constexpr char STR_PID_TOP_HEADER[] =
+    "[IO_PID]       rchar,       wchar,  read_bytes, write_bytes, cancelled :   PID   UID NAME\n";
+static constexpr char FMT_STR_PID_TOP_USAGE[] = "[P%-5zu]%12" PRIu64 ",%12" PRIu64 ",%12" PRIu64
+                                                ",%12" PRIu64 ",%10" PRIu64 " :%6u%6u %s\n";
+static constexpr char FMT_STR_ANOMALY[] = "[IO_ANOMALY] baseline %.2fMB +/- %.2fMB\n";
+static constexpr char FMT_STR_BURST[] =
+    "[IO_BURST    ] %u %s: %.1fMB/s for %.1fs (window %.1fMB/s)\n";
+static constexpr char FMT_STR_BURST_END[] =
+    "[IO_BURST_END] %u %s: %.1fMB/s for %.1fs (window %.1fMB/s)\n";
+static constexpr char FMT_STR_SKIP_TOP[] = "(< %" PRIu64 "MB)skip %s";
+
+struct IoRankInfo {
+    const char *name;  // used by the iostats.rank option
+    const char *tag;   // row prefix in the dump
+    const char *skip;  // shown when the total is below the dump threshold
+    bool isRead;       // which byte columns the rows show
+};
+// Indexed by IoRankKey
+static constexpr IoRankInfo IO_RANK_INFO[IO_RANK_MAX] = {
+    {"read", "R", "RD", true},           {"write", "W", "WR", false},
+    {"fsync", "F", "FSYNC", false},      {"fgread", "FR", "FG RD", true},
+    {"bgread", "BR", "BG RD", true},     {"fgwrite", "FW", "FG WR", false},
+    {"bgwrite", "BW", "BG WR", false},
+};
 
 static bool sOptDebug = false;
 
@@ -73,228 +97,416 @@ static bool isAppUid(uint32_t uid) {
     return false;
 }
 
-std::vector<uint32_t> ProcPidIoStats::getNewPids() {
-    std::vector<uint32_t> newpids;
-    // Not exists in Previous
-    for (int i = 0, len = mCurrPids.size(); i < len; i++) {
-        if (std::find(mPrevPids.begin(), mPrevPids.end(), mCurrPids[i]) == mPrevPids.end()) {
-            newpids.push_back(mCurrPids[i]);
+/*
+ * Both pid lists are sorted, so one merge pass finds the pids that appeared
+ * and the pids that exited since the previous update.
+ */
+void ProcPidIoStats::diffPids(std::vector<uint32_t> *newPids, std::vector<uint32_t> *exitedPids) {
+    newPids->clear();
+    exitedPids->clear();
+    auto prev = mPrevPids.cbegin();
+    auto curr = mCurrPids.cbegin();
+    while (prev != mPrevPids.cend() || curr != mCurrPids.cend()) {
+        if (curr == mCurrPids.cend() || (prev != mPrevPids.cend() && *prev < *curr)) {
+            exitedPids->push_back(*prev++);
+        } else if (prev == mPrevPids.cend() || *curr < *prev) {
+            newPids->push_back(*curr++);
+        } else {
+            ++prev;
+            ++curr;
         }
     }
-    return newpids;
+}
+
+static bool pidUidLess(const std::pair<uint32_t, uint32_t> &a,
+                       const std::pair<uint32_t, uint32_t> &b) {
+    return a.first < b.first;
+}
+
+void ProcPidIoStats::removeExitedPids(const std::vector<uint32_t> &exitedPids) {
+    if (exitedPids.empty()) {
+        return;
+    }
+    // mPidUids and exitedPids are both sorted by pid
+    auto exited = exitedPids.cbegin();
+    auto out = mPidUids.begin();
+    for (auto it = mPidUids.begin(); it != mPidUids.end(); ++it) {
+        while (exited != exitedPids.cend() && *exited < it->first) ++exited;
+        if (exited == exitedPids.cend() || *exited != it->first) {
+            *out++ = *it;
+            continue;
+        }
+        // Age out the uid name once its last known process is gone
+        auto name = mUidNameMapping.find(it->second);
+        if (name != mUidNameMapping.end() && --name->second.pids == 0) {
+            mUidNameMapping.erase(name);
+        }
+    }
+    mPidUids.erase(out, mPidUids.end());
 }
 
 void ProcPidIoStats::update(bool forceAll) {
-    ScopeTimer _debugTimer("update: /proc/pid/status for UID/Name mapping");
+    ScopeTimer _debugTimer("update: process identities for UID/Name mapping");
     _debugTimer.setEnabled(sOptDebug);
     if (forceAll) {
         mPrevPids.clear();
+        mPidUids.clear();
+        mUidNameMapping.clear();
     } else {
         mPrevPids = mCurrPids;
     }
     // Get current pid list
-    mCurrPids.clear();
-    DIR *dir;
-    struct dirent *ent;
-    if ((dir = opendir("/proc/")) == NULL) {
-        LOG_TO(SYSTEM, ERROR) << "failed on opendir '/proc/'";
-        return;
-    }
-    while ((ent = readdir(dir)) != NULL) {
-        if (ent->d_type == DT_DIR) {
-            uint32_t pid;
-            if (android::base::ParseUint(ent->d_name, &pid)) {
-                mCurrPids.push_back(pid);
-            }
-        }
-    }
-    std::vector<uint32_t> newpids = getNewPids();
+    mCurrPids = mProcSnapshot->getPids();
+    diffPids(&mNewPids, &mExitedPids);
+    removeExitedPids(mExitedPids);
+    const std::vector<uint32_t> &newpids = mNewPids;
+    size_t knownPids = mPidUids.size();
+    auto start = std::chrono::steady_clock::now();
+    size_t processed = 0;
     // update mUidNameMapping only for new pids
-    for (int i = 0, len = newpids.size(); i < len; i++) {
+    for (int i = 0, len = newpids.size(); i < len; i++, processed++) {
+        if (mScanPids > 0 && processed >= mScanPids)
+            break;
+        if (mScanUs > 0 && std::chrono::duration_cast<std::chrono::microseconds>(
+                                   std::chrono::steady_clock::now() - start)
+                                       .count() >= mScanUs)
+            break;
         uint32_t pid = newpids[i];
         if (sOptDebug > 1)
             LOG_TO(SYSTEM, INFO) << i << ".";
-        std::string buffer;
-        if (!android::base::ReadFileToString("/proc/" + std::to_string(pid) + "/status", &buffer)) {
+        const ProcIdentity *identity = mProcSnapshot->getIdentity(pid);
+        if (identity == nullptr) {
             if (sOptDebug)
-                LOG_TO(SYSTEM, INFO) << "/proc/" << std::to_string(pid) << "/status"
-                                     << ": ReadFileToString failed (process died?)";
-            continue;
-        }
-        // --- Find Name ---
-        size_t s = buffer.find("Name:");
-        if (s == std::string::npos) {
-            continue;
-        }
-        s += std::strlen("Name:");
-        // find the pos of next word
-        while (buffer[s] && isspace(buffer[s])) s++;
-        if (buffer[s] == 0) {
+                LOG_TO(SYSTEM, INFO) << "/proc/" << std::to_string(pid)
+                                     << ": read failed (process died?)";
             continue;
         }
-        size_t e = s;
-        // find the end pos of the word
-        while (buffer[e] && !std::isspace(buffer[e])) e++;
-        std::string pname(buffer, s, e - s);
-
-        // --- Find Uid ---
-        s = buffer.find("\nUid:", e);
-        if (s == std::string::npos) {
-            continue;
-        }
-        s += std::strlen("\nUid:");
-        // find the pos of next word
-        while (buffer[s] && isspace(buffer[s])) s++;
-        if (buffer[s] == 0) {
-            continue;
-        }
-        e = s;
-        // find the end pos of the word
-        while (buffer[e] && !std::isspace(buffer[e])) e++;
-        std::string strUid(buffer, s, e - s);
-
+        uint32_t uid = identity->uid;
         if (sOptDebug > 1)
-            LOG_TO(SYSTEM, INFO) << "(pid, name, uid)=(" << pid << ", " << pname << ", " << strUid
-                                 << ")" << std::endl;
-        uint32_t uid = (uint32_t)std::stoi(strUid);
-        mUidNameMapping[uid] = pname;
+            LOG_TO(SYSTEM, INFO) << "(pid, name, uid)=(" << pid << ", " << identity->comm << ", "
+                                 << uid << ")" << std::endl;
+        UidName &entry = mUidNameMapping[uid];
+        entry.name = identity->comm;
+        entry.pids++;
+        mPidUids.emplace_back(pid, uid);
+    }
+    // New pids were appended in ascending order; merge them into place
+    std::inplace_merge(mPidUids.begin(), mPidUids.begin() + knownPids, mPidUids.end(),
+                       pidUidLess);
+    // Pids past the budget are dropped from mCurrPids to show up as new again
+    if (processed < newpids.size()) {
+        auto deferred = newpids.begin() + processed;
+        mCurrPids.erase(std::remove_if(mCurrPids.begin(), mCurrPids.end(),
+                                       [&](uint32_t pid) {
+                                           return std::binary_search(deferred, newpids.end(),
+                                                                     pid);
+                                       }),
+                        mCurrPids.end());
+        if (sOptDebug)
+            LOG_TO(SYSTEM, INFO) << newpids.size() - processed << " new pids deferred";
     }
 }
 
 bool ProcPidIoStats::getNameForUid(uint32_t uid, std::string *name) {
-    if (mUidNameMapping.find(uid) != mUidNameMapping.end()) {
-        *name = mUidNameMapping[uid];
+    auto it = mUidNameMapping.find(uid);
+    if (it != mUidNameMapping.end()) {
+        *name = it->second.name;
         return true;
     }
     return false;
 }
 
-void IoStats::updateTopRead(UserIo usage) {
-    UserIo tmp;
-    for (int i = 0, len = IO_TOP_MAX; i < len; i++) {
-        if (usage.sumRead() > mReadTop[i].sumRead()) {
-            // if new read > old read, then swap values
-            tmp = mReadTop[i];
-            mReadTop[i] = usage;
-            usage = tmp;
+void IoTopRanker::reset(size_t count) {
+    mCount = count;
+    mTop.clear();
+}
+
+void IoTopRanker::offer(const UserIo &usage) {
+    uint64_t value = rankValue(usage, mKey);
+    if (value == 0 || mCount == 0) {
+        return;
+    }
+    auto cmp = [this](const UserIo &a, const UserIo &b) { return heapLess(a, b); };
+    if (mTop.size() < mCount) {
+        mTop.push_back(usage);
+        std::push_heap(mTop.begin(), mTop.end(), cmp);
+    } else if (value > rankValue(mTop.front(), mKey)) {
+        // replace the smallest of the current top
+        std::pop_heap(mTop.begin(), mTop.end(), cmp);
+        mTop.back() = usage;
+        std::push_heap(mTop.begin(), mTop.end(), cmp);
+    }
+}
+
+const std::vector<UserIo> &IoTopRanker::finish() {
+    auto cmp = [this](const UserIo &a, const UserIo &b) { return heapLess(a, b); };
+    std::sort_heap(mTop.begin(), mTop.end(), cmp);
+    return mTop;
+}
+
+// Clear the buckets a slot missed since it was last touched
+void IoBurstDetector::advance(Slot *slot) {
+    uint64_t missed = std::min<uint64_t>(mTick - slot->lastTick, IO_BURST_WINDOW_BUCKETS);
+    for (uint64_t t = mTick - missed + 1; t <= mTick; t++) {
+        uint64_t &bucket = slot->buckets[t % IO_BURST_WINDOW_BUCKETS];
+        slot->sum -= bucket;
+        bucket = 0;
+    }
+    slot->lastTick = mTick;
+}
+
+IoBurstDetector::Slot *IoBurstDetector::findSlot(uint32_t uid) {
+    auto it = std::lower_bound(mByUid.begin(), mByUid.end(), uid, slotUidLess);
+    return it != mByUid.end() && (*it)->uid == uid ? *it : nullptr;
+}
+
+IoBurstDetector::Slot *IoBurstDetector::allocSlot(uint32_t uid) {
+    Slot *victim = nullptr;
+    for (Slot &slot : mSlots) {
+        if (!slot.used) {
+            victim = &slot;
+            break;
         }
+        // Never recycle a UID that is bursting right now
+        if (slot.burstMs == 0 && (victim == nullptr || slot.sum < victim->sum)) {
+            victim = &slot;
+        }
+    }
+    if (victim == nullptr) {
+        return nullptr;
     }
+    if (victim->used) {
+        mByUid.erase(std::lower_bound(mByUid.begin(), mByUid.end(), victim->uid, slotUidLess));
+    }
+    mByUid.insert(std::lower_bound(mByUid.begin(), mByUid.end(), uid, slotUidLess), victim);
+    *victim = Slot();
+    victim->used = true;
+    victim->uid = uid;
+    victim->lastTick = mTick;
+    return victim;
 }
 
-void IoStats::updateTopWrite(UserIo usage) {
-    UserIo tmp;
-    for (int i = 0, len = IO_TOP_MAX; i < len; i++) {
-        if (usage.sumWrite() > mWriteTop[i].sumWrite()) {
-            // if new write > old write, then swap values
-            tmp = mWriteTop[i];
-            mWriteTop[i] = usage;
-            usage = tmp;
+void IoBurstDetector::record(Slot *slot, uint64_t bytes, uint64_t intervalMs) {
+    advance(slot);
+    slot->buckets[mTick % IO_BURST_WINDOW_BUCKETS] = bytes;
+    slot->sum += bytes;
+    if (bytes * 1000 >= mRate * intervalMs) {
+        slot->burstBytes += bytes;
+        slot->burstMs += intervalMs;
+        if (!slot->reported && slot->burstMs >= mDurationMs) {
+            slot->reported = true;
+            mEvents.push_back(
+                {slot->uid, false, slot->burstBytes, slot->burstMs, slot->sum, mWindowMs});
         }
+        return;
+    }
+    if (slot->reported) {
+        mEvents.push_back(
+            {slot->uid, true, slot->burstBytes, slot->burstMs, slot->sum, mWindowMs});
     }
+    slot->burstBytes = 0;
+    slot->burstMs = 0;
+    slot->reported = false;
 }
 
-void IoStats::updateUnknownUidList() {
-    if (!mUnknownUidList.size()) {
+void IoBurstDetector::update(const std::vector<UserIo> &diffs, uint64_t intervalMs) {
+    mEvents.clear();
+    if (mRate == 0 || intervalMs == 0) {
+        return;
+    }
+    mTick++;
+    uint64_t &bucketMs = mBucketMs[mTick % IO_BURST_WINDOW_BUCKETS];
+    mWindowMs = mWindowMs - bucketMs + intervalMs;
+    bucketMs = intervalMs;
+
+    // Tracked UIDs, whether or not they did IO in this interval; both lists
+    // are sorted by uid, so one merge pass pairs them up
+    auto d = diffs.begin();
+    for (Slot *slot : mByUid) {
+        while (d != diffs.end() && d->uid < slot->uid) ++d;
+        uint64_t bytes = 0;
+        if (d != diffs.end() && d->uid == slot->uid) {
+            bytes = d->sumRead() + d->sumWrite();
+        }
+        record(slot, bytes, intervalMs);
+    }
+    // New UIDs only need a slot once they go over the rate
+    for (const UserIo &d : diffs) {
+        uint64_t bytes = d.sumRead() + d.sumWrite();
+        if (bytes * 1000 < mRate * intervalMs || findSlot(d.uid) != nullptr) {
+            continue;
+        }
+        Slot *slot = allocSlot(d.uid);
+        if (slot == nullptr) {
+            LOG_TO(SYSTEM, WARNING) << "IO burst table full, uid " << d.uid << " not tracked";
+            continue;
+        }
+        record(slot, bytes, intervalMs);
+    }
+}
+
+bool IoStats::setRankKeys(const std::string &keys) {
+    std::vector<IoTopRanker> rankers;
+    for (const auto &name : android::base::Split(keys, ",")) {
+        int key = 0;
+        while (key < IO_RANK_MAX && name != IO_RANK_INFO[key].name) key++;
+        if (key == IO_RANK_MAX) {
+            LOG_TO(SYSTEM, ERROR) << "unknown IO rank key: " << name;
+            return false;
+        }
+        rankers.emplace_back(static_cast<IoRankKey>(key));
+    }
+    std::lock_guard<std::mutex> lock(mRankersMutex);
+    mRankers = std::move(rankers);
+    return true;
+}
+
+static constexpr const char *PACKAGES_LIST_PATH = "/data/system/packages.list";
+
+void UidNameCache::reloadPackagesIfChanged() {
+    struct stat st;
+    if (stat(PACKAGES_LIST_PATH, &st) != 0) {
+        return;
+    }
+    if (st.st_mtim.tv_sec == mPackagesMtime.tv_sec &&
+        st.st_mtim.tv_nsec == mPackagesMtime.tv_nsec) {
         return;
     }
-    ScopeTimer _debugTimer("update overall UID/Name");
+    ScopeTimer _debugTimer("reload " + std::string(PACKAGES_LIST_PATH));
     _debugTimer.setEnabled(sOptDebug);
-    mProcIoStats.update(false);
-    for (uint32_t i = 0, len = mUnknownUidList.size(); i < len; i++) {
-        uint32_t uid = mUnknownUidList[i];
-        if (isAppUid(uid)) {
-            // Get IO throughput for App processes
-            std::string pname;
-            if (!mProcIoStats.getNameForUid(uid, &pname)) {
-                if (sOptDebug)
-                    LOG_TO(SYSTEM, WARNING) << "unable to find App uid:" << uid;
-                continue;
-            }
-            mUidNameMap[uid] = pname;
-        } else {
-            // Get IO throughput for system/native processes
-            passwd *usrpwd = getpwuid(uid);
-            if (!usrpwd) {
-                if (sOptDebug)
-                    LOG_TO(SYSTEM, WARNING) << "unable to find uid:" << uid << " by getpwuid";
-                continue;
-            }
-            mUidNameMap[uid] = std::string(usrpwd->pw_name);
-            if (std::find(mUnknownUidList.begin(), mUnknownUidList.end(), uid) !=
-                mUnknownUidList.end()) {
-            }
+    std::string buffer;
+    if (!readFileToBuffer(PACKAGES_LIST_PATH, &buffer)) {
+        LOG_TO(SYSTEM, WARNING) << PACKAGES_LIST_PATH << ": read failed";
+        return;
+    }
+    mPackagesMtime = st.st_mtim;
+    // Packages changed: anything cached may be stale
+    mNames.clear();
+    // Each line: "<package> <appId> <debuggable> <dataDir> <seinfo> <gids>"
+    TextScanner scanner(buffer);
+    for (; !scanner.atEnd(); scanner.nextLine()) {
+        std::string_view package;
+        uint32_t uid;
+        if (!scanner.token(&package) || !scanner.parseUint(&uid)) {
+            continue;
         }
-        mUnknownUidList.erase(std::remove(mUnknownUidList.begin(), mUnknownUidList.end(), uid),
-                              mUnknownUidList.end());
+        // Packages sharing a uid keep the first entry
+        mNames.emplace(uid, std::string(package));
     }
+    if (sOptDebug)
+        LOG_TO(SYSTEM, INFO) << "loaded " << mNames.size() << " packages";
+}
 
-    if (sOptDebug && mUnknownUidList.size() > 0) {
-        std::stringstream msg;
-        msg << "Some UID/Name can't be retrieved: ";
-        for (const auto &i : mUnknownUidList) {
-            msg << i << ", ";
+bool UidNameCache::resolve(uint32_t uid, std::string *name) {
+    if (isAppUid(uid)) {
+        // packages.list only holds user 0 app ids
+        auto it = mNames.find(uid % AID_USER_OFFSET);
+        if (it != mNames.end()) {
+            *name = it->second;
+            return true;
+        }
+        // Get name for App processes from /proc, walking it at most once per tick
+        if (!mProcScanned) {
+            mProcIoStats.update(false);
+            mProcScanned = true;
         }
-        LOG_TO(SYSTEM, WARNING) << msg.str();
+        if (mProcIoStats.getNameForUid(uid, name)) {
+            return true;
+        }
+        if (sOptDebug)
+            LOG_TO(SYSTEM, WARNING) << "unable to find App uid:" << uid;
+        return false;
+    }
+    // Get name for system/native processes
+    passwd *usrpwd = getpwuid(uid);
+    if (!usrpwd) {
+        if (sOptDebug)
+            LOG_TO(SYSTEM, WARNING) << "unable to find uid:" << uid << " by getpwuid";
+        return false;
     }
-    mUnknownUidList.clear();
+    *name = usrpwd->pw_name;
+    return true;
 }
 
-std::unordered_map<uint32_t, UserIo> IoStats::calcIncrement(
-    const std::unordered_map<uint32_t, UserIo> &data) {
-    std::unordered_map<uint32_t, UserIo> diffs;
-    for (const auto &it : data) {
-        const UserIo &d = it.second;
-        // If data not existed, copy one, else calculate the increment.
-        if (mPrevious.find(d.uid) == mPrevious.end()) {
-            diffs[d.uid] = d;
-        } else {
-            diffs[d.uid] = d - mPrevious[d.uid];
+void UidNameCache::invalidate() {
+    mProcScanned = false;
+    reloadPackagesIfChanged();
+}
+
+const char *UidNameCache::getName(uint32_t uid) {
+    auto it = mNames.find(uid);
+    if (it == mNames.end()) {
+        std::string name;
+        if (!resolve(uid, &name)) {
+            return "-";
         }
-        // If uid not existed in UidNameMap, then add into unknown list
-        if ((diffs[d.uid].sumRead() || diffs[d.uid].sumWrite()) &&
-            mUidNameMap.find(d.uid) == mUidNameMap.end()) {
-            mUnknownUidList.push_back(d.uid);
+        it = mNames.emplace(uid, std::move(name)).first;
+    }
+    return it->second.c_str();
+}
+
+static bool uidLess(const UserIo &a, const UserIo &b) {
+    return a.uid < b.uid;
+}
+
+/*
+ * Both tables are sorted by uid, so the increments come out of a single
+ * merge-join pass. UIDs only present in |data| are new and count in full;
+ * UIDs only present in mPrevious are gone and produce nothing.
+ */
+void IoStats::calcIncrement(const std::vector<UserIo> &data) {
+    mDiffs.clear();
+    auto prev = mPrevious.cbegin();
+    for (const UserIo &d : data) {
+        while (prev != mPrevious.cend() && prev->uid < d.uid) ++prev;
+        if (prev != mPrevious.cend() && prev->uid == d.uid) {
+            mDiffs.push_back(d - *prev);
+        } else {
+            mDiffs.push_back(d);
         }
     }
-    // update Uid/Name mapping for dump()
-    updateUnknownUidList();
-    return diffs;
 }
 
-void IoStats::calcAll(std::unordered_map<uint32_t, UserIo> &&data) {
+bool IoStats::calcAll(std::vector<UserIo> *data) {
+    // /proc/uid_io/stats walks a hash table, so rows come in arbitrary order;
+    // sort them for the merge with the previous table.
+    std::sort(data->begin(), data->end(), uidLess);
+    mUidNames.invalidate();
     // if mList == mNow, it's in init state.
     if (mLast == mNow) {
-        mPrevious = std::move(data);
+        mPrevious.swap(*data);
         mLast = mNow;
-        mNow = std::chrono::system_clock::now();
-        mProcIoStats.update(true);
-        for (const auto &d : data) {
-            mUnknownUidList.push_back(d.first);
-        }
-        updateUnknownUidList();
-        return;
+        mNow = std::chrono::steady_clock::now();
+        return false;
     }
     mLast = mNow;
-    mNow = std::chrono::system_clock::now();
+    mNow = std::chrono::steady_clock::now();
 
     // calculate incremental IO throughput
-    std::unordered_map<uint32_t, UserIo> amounts = calcIncrement(data);
-    // assign current data to Previous for next calculating
-    mPrevious = std::move(data);
+    calcIncrement(*data);
+    // Keep current data as Previous for next calculating; the caller gets the
+    // old buffer back to refill, so no table is reallocated in steady state.
+    mPrevious.swap(*data);
     // Reset Total and Tops
+    std::lock_guard<std::mutex> lock(mRankersMutex);
     mTotal.reset();
-    for (int i = 0, len = IO_TOP_MAX; i < len; i++) {
-        mReadTop[i].reset();
-        mWriteTop[i].reset();
+    for (auto &ranker : mRankers) {
+        ranker.reset(mTopCount);
     }
-    for (const auto &it : amounts) {
-        const UserIo &d = it.second;
+    // One pass over the UID table feeds every ranking
+    for (const UserIo &d : mDiffs) {
         // Add into total
         mTotal = mTotal + d;
-        // Check if it's top
-        updateTopRead(d);
-        updateTopWrite(d);
+        for (auto &ranker : mRankers) {
+            ranker.offer(d);
+        }
     }
+    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(mNow - mLast);
+    mBursts.update(mDiffs, ms.count());
+    mBaselineMean = mBaseline.mean();
+    mBaselineStddev = mBaseline.stddev();
+    mAnomaly = mBaseline.update((mTotal.sumRead() + mTotal.sumWrite()) / 1000000.0f);
+    return true;
 }
 
 /* Dump IO usage (Sample Log)
@@ -311,6 +523,7 @@ void IoStats::calcAll(std::unordered_map<uint32_t, UserIo> &&data) {
  * [W3: 11.30%]     1486848,           0,   58,    0 :  1000 system
  * [W4:  8.13%]      667648,      401408,   23,   20 : 10061 android.vending
  * [W5:  5.35%]           0,      704512,    0,   25 : 10055 -
+ * [IO_BURST    ] 10016 .android.gms.ui: 24.6MB/s for 30.2s (window 9.8MB/s)
  *
  */
 bool IoStats::dump(std::stringstream *output) {
@@ -331,66 +544,261 @@ bool IoStats::dump(std::stringstream *output) {
     out << android::base::StringPrintf(FMT_STR_TOTAL_USAGE, ms.count() / 1000, ms.count() % 1000,
                                        readTotal, writeTotal, mTotal.fgFsync + mTotal.bgFsync);
 
-    if (mTotal.sumRead() >= mMinSizeOfTotalRead || mTotal.sumWrite() >= mMinSizeOfTotalWrite) {
-        out << STR_TOP_HEADER;
-    }
-    // Dump READ TOP
-    if (mTotal.sumRead() < mMinSizeOfTotalRead) {
-        out << android::base::StringPrintf(FMT_STR_SKIP_TOP_READ, mMinSizeOfTotalRead / 1000000)
-            << std::endl;
-    } else {
-        for (int i = 0, len = IO_TOP_MAX; i < len; i++) {
-            UserIo &target = mReadTop[i];
-            if (target.sumRead() == 0) {
-                break;
+    // Once the baseline is up, only intervals standing out from it get the
+    // rankings; otherwise the fixed size thresholds decide.
+    std::lock_guard<std::mutex> lock(mRankersMutex);
+    if (mBaseline.active()) {
+        if (mAnomaly) {
+            out << android::base::StringPrintf(FMT_STR_ANOMALY, mBaselineMean, mBaselineStddev);
+            out << STR_TOP_HEADER;
+            for (auto &ranker : mRankers) {
+                dumpTop(ranker, true, out);
             }
-            float percent = 100.0f * target.sumRead() / mTotal.sumRead();
-            const char *package = mUidNameMap.find(target.uid) == mUidNameMap.end()
-                                      ? "-"
-                                      : mUidNameMap[target.uid].c_str();
-            out << android::base::StringPrintf(FMT_STR_TOP_READ_USAGE, i + 1, percent,
-                                               target.fgRead, target.bgRead, target.fgFsync,
-                                               target.bgFsync, target.uid, package);
         }
+    } else {
+        // The fsync ranking has no size threshold, so it only lists itself when asked for
+        bool fsyncRanked =
+            std::any_of(mRankers.begin(), mRankers.end(), [](const IoTopRanker &ranker) {
+                return ranker.key() == IO_RANK_FSYNC;
+            });
+        if (mTotal.sumRead() >= mMinSizeOfTotalRead ||
+            mTotal.sumWrite() >= mMinSizeOfTotalWrite ||
+            (fsyncRanked && mTotal.sumFsync() > 0)) {
+            out << STR_TOP_HEADER;
+        }
+        for (auto &ranker : mRankers) {
+            dumpTop(ranker, false, out);
+        }
+    }
+    for (const auto &event : mBursts.events()) {
+        float rate = event.durationMs ? event.bytes * 1000.0f / event.durationMs / 1000000 : 0;
+        float windowRate =
+            event.windowMs ? event.windowBytes * 1000.0f / event.windowMs / 1000000 : 0;
+        out << android::base::StringPrintf(
+            event.ended ? FMT_STR_BURST_END : FMT_STR_BURST, event.uid,
+            mUidNames.getName(event.uid), rate, event.durationMs / 1000.0f, windowRate);
+    }
+    return true;
+}
+
+void IoStats::getTopWriters(size_t count,
+                            std::vector<std::tuple<uint32_t, std::string, uint64_t>> *out) {
+    out->clear();
+    IoTopRanker ranker(IO_RANK_WRITE);
+    ranker.reset(count);
+    for (const UserIo &d : mDiffs) {
+        ranker.offer(d);
+    }
+    for (const UserIo &d : ranker.finish()) {
+        out->emplace_back(d.uid, mUidNames.getName(d.uid), d.sumWrite());
     }
+}
 
-    // Dump WRITE TOP
-    if (mTotal.sumWrite() < mMinSizeOfTotalWrite) {
-        out << android::base::StringPrintf(FMT_STR_SKIP_TOP_WRITE, mMinSizeOfTotalWrite / 1000000)
+void IoStats::dumpTop(IoTopRanker &ranker, bool force, std::stringstream &out) {
+    const IoRankInfo &info = IO_RANK_INFO[ranker.key()];
+    const std::vector<UserIo> &top = ranker.finish();
+    uint64_t total = rankValue(mTotal, ranker.key());
+    // |force| lists the ranking regardless of the size thresholds
+    if (ranker.key() == IO_RANK_FSYNC || force) {
+        if (total == 0) {
+            return;
+        }
+    } else if (info.isRead && mTotal.sumRead() < mMinSizeOfTotalRead) {
+        out << android::base::StringPrintf(FMT_STR_SKIP_TOP, mMinSizeOfTotalRead / 1000000,
+                                           info.skip)
             << std::endl;
-    } else {
-        for (int i = 0, len = IO_TOP_MAX; i < len; i++) {
-            UserIo &target = mWriteTop[i];
-            if (target.sumWrite() == 0) {
-                break;
-            }
-            float percent = 100.0f * target.sumWrite() / mTotal.sumWrite();
-            const char *package = mUidNameMap.find(target.uid) == mUidNameMap.end()
-                                      ? "-"
-                                      : mUidNameMap[target.uid].c_str();
-            out << android::base::StringPrintf(FMT_STR_TOP_WRITE_USAGE, i + 1, percent,
-                                               target.fgWrite, target.bgWrite, target.fgFsync,
-                                               target.bgFsync, target.uid, package);
+        return;
+    } else if (!info.isRead && mTotal.sumWrite() < mMinSizeOfTotalWrite) {
+        out << android::base::StringPrintf(FMT_STR_SKIP_TOP, mMinSizeOfTotalWrite / 1000000,
+                                           info.skip)
+            << std::endl;
+        return;
+    }
+    for (size_t i = 0; i < top.size(); i++) {
+        const UserIo &target = top[i];
+        float percent = 100.0f * rankValue(target, ranker.key()) / total;
+        // Names are only resolved for the uids that made it to the top
+        const char *package = mUidNames.getName(target.uid);
+        out << android::base::StringPrintf(FMT_STR_TOP_USAGE, info.tag, i + 1, percent,
+                                           info.isRead ? target.fgRead : target.fgWrite,
+                                           info.isRead ? target.bgRead : target.bgWrite,
+                                           target.fgFsync, target.bgFsync, target.uid, package);
+    }
+}
+
+/*
+ * Parse /proc/uid_io/stats in place. Each line is
+ *   uid fgRchar fgWchar fgRead fgWrite bgRchar bgWchar bgRead bgWrite fgFsync bgFsync
+ * and the result reuses the storage of |out|.
+ */
+void android::pixel::perfstatsd::parseUidIoStats(std::string_view text, std::vector<UserIo> *out) {
+    out->clear();
+    TextScanner scanner(text);
+    for (; !scanner.atEnd(); scanner.nextLine()) {
+        if (scanner.atEol()) {
+            continue;
+        }
+        UserIo data;
+        if (!scanner.parseUint(&data.uid) || !scanner.skipToken() || !scanner.skipToken() ||
+            !scanner.parseUint(&data.fgRead) || !scanner.parseUint(&data.fgWrite) ||
+            !scanner.skipToken() || !scanner.skipToken() || !scanner.parseUint(&data.bgRead) ||
+            !scanner.parseUint(&data.bgWrite) || !scanner.parseUint(&data.fgFsync) ||
+            !scanner.parseUint(&data.bgFsync)) {
+            LOG_TO(SYSTEM, WARNING) << "Invalid uid I/O stats: \"" << scanner.restOfLine()
+                                    << "\"";
+            continue;
         }
+        out->push_back(data);
     }
+}
+
+bool PidIoStats::setUids(const std::string &uids) {
+    std::vector<uint32_t> list;
+    for (const auto &str : android::base::Split(uids, ",")) {
+        uint32_t uid;
+        if (str.empty()) {
+            continue;
+        }
+        if (!android::base::ParseUint(str, &uid)) {
+            LOG_TO(SYSTEM, ERROR) << "Invalid uid: " << str;
+            return false;
+        }
+        list.push_back(uid);
+    }
+    std::sort(list.begin(), list.end());
+    std::lock_guard<std::mutex> lock(mUidsMutex);
+    mUids = std::move(list);
+    mPrevious.clear();
+    mPrimed = false;
     return true;
 }
 
-static bool loadDataFromLine(std::string &&line, UserIo &data) {
-    std::vector<std::string> fields = android::base::Split(line, " ");
-    if (fields.size() < 11 || !android::base::ParseUint(fields[0], &data.uid) ||
-        !android::base::ParseUint(fields[3], &data.fgRead) ||
-        !android::base::ParseUint(fields[4], &data.fgWrite) ||
-        !android::base::ParseUint(fields[7], &data.bgRead) ||
-        !android::base::ParseUint(fields[8], &data.bgWrite) ||
-        !android::base::ParseUint(fields[9], &data.fgFsync) ||
-        !android::base::ParseUint(fields[10], &data.bgFsync)) {
-        LOG_TO(SYSTEM, WARNING) << "Invalid uid I/O stats: \"" << line << "\"";
+bool PidIoStats::readPid(uint32_t pid, PidIo *io) {
+    const ProcIdentity *identity = mProcSnapshot->getIdentity(pid);
+    if (identity == nullptr || !std::binary_search(mUids.begin(), mUids.end(), identity->uid)) {
+        return false;
+    }
+    io->uid = identity->uid;
+    io->starttime = identity->starttime;
+    size_t len = std::min(identity->comm.size(), sizeof(io->name) - 1);
+    memcpy(io->name, identity->comm.data(), len);
+    io->name[len] = '\0';
+    char path[32];
+    snprintf(path, sizeof(path), "/proc/%u/io", pid);
+    if (!readFileToBuffer(path, &mBuffer)) {
         return false;
     }
+    io->pid = pid;
+    io->rchar = io->wchar = io->readBytes = io->writeBytes = io->cancelledWriteBytes = 0;
+    TextScanner scanner(mBuffer);
+    for (; !scanner.atEnd(); scanner.nextLine()) {
+        uint64_t *field = nullptr;
+        if (scanner.consume("rchar:")) {
+            field = &io->rchar;
+        } else if (scanner.consume("wchar:")) {
+            field = &io->wchar;
+        } else if (scanner.consume("read_bytes:")) {
+            field = &io->readBytes;
+        } else if (scanner.consume("write_bytes:")) {
+            field = &io->writeBytes;
+        } else if (scanner.consume("cancelled_write_bytes:")) {
+            field = &io->cancelledWriteBytes;
+        }
+        if (field != nullptr && !scanner.parseUint(field)) {
+            return false;
+        }
+    }
     return true;
 }
 
+// Clock ticks since boot, the unit of the starttime in /proc/<pid>/stat
+static uint64_t bootTicks(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_BOOTTIME, &ts);
+    static const long clkTck = sysconf(_SC_CLK_TCK);
+    return ts.tv_sec * clkTck + ts.tv_nsec / (1000000000L / clkTck);
+}
+
+void PidIoStats::refresh() {
+    std::lock_guard<std::mutex> lock(mUidsMutex);
+    mCurrent.clear();
+    mDiffs.clear();
+    if (mUids.empty()) {
+        return;
+    }
+    uint64_t now = bootTicks();
+    ScopeTimer _debugTimer("update: /proc/pid/io");
+    _debugTimer.setEnabled(sOptDebug);
+    // Snapshot pids are sorted, so mCurrent comes out sorted by pid
+    for (uint32_t pid : mProcSnapshot->getPids()) {
+        PidIo io;
+        if (readPid(pid, &io)) {
+            mCurrent.push_back(io);
+        }
+    }
+    // The first sample after enabling or changing the uids only primes the
+    // table; lifetime totals are not an interval
+    if (!mPrimed) {
+        mPrevious.swap(mCurrent);
+        mPrimed = true;
+        mLastTick = now;
+        return;
+    }
+    auto prev = mPrevious.cbegin();
+    for (const PidIo &curr : mCurrent) {
+        while (prev != mPrevious.cend() && prev->pid < curr.pid) ++prev;
+        PidIo diff = curr;
+        if (prev != mPrevious.cend() && prev->pid == curr.pid &&
+            prev->starttime == curr.starttime) {
+            diff.rchar -= prev->rchar;
+            diff.wchar -= prev->wchar;
+            diff.readBytes -= prev->readBytes;
+            diff.writeBytes -= prev->writeBytes;
+            diff.cancelledWriteBytes -= prev->cancelledWriteBytes;
+        } else if (curr.starttime < mLastTick) {
+            // Older than the last tick but not sampled then, e.g. its uid
+            // changed or its io was unreadable: no baseline to diff against
+            continue;
+        }
+        // Otherwise it started within the interval and all its IO counts
+        if (diff.rchar || diff.wchar || diff.sumBytes()) {
+            mDiffs.push_back(diff);
+        }
+    }
+    mPrevious.swap(mCurrent);
+    mLastTick = now;
+
+    size_t count = std::min<size_t>(mTopCount, mDiffs.size());
+    std::partial_sort(mDiffs.begin(), mDiffs.begin() + count, mDiffs.end(),
+                      [](const PidIo &a, const PidIo &b) {
+                          if (a.sumBytes() != b.sumBytes())
+                              return a.sumBytes() > b.sumBytes();
+                          return a.wchar + a.rchar > b.wchar + b.rchar;
+                      });
+    mDiffs.resize(count);
+}
+
+/* Dump per process IO of the configured UIDs (Sample Log)
+ *
+ * [IO_PID]       rchar,       wchar,  read_bytes, write_bytes, cancelled :   PID   UID NAME
+ * [P1    ]     1048576,    20971520,           0,    20480000,         0 :   812  1000 statsd
+ * [P2    ]      262144,     4194304,       40960,     4096000,      8192 :     1     0 init
+ */
+void PidIoStats::dump(std::stringstream *output) {
+    if (mDiffs.empty()) {
+        return;
+    }
+    std::stringstream &out = (*output);
+    out << STR_PID_TOP_HEADER;
+    for (size_t i = 0; i < mDiffs.size(); i++) {
+        const PidIo &target = mDiffs[i];
+        out << android::base::StringPrintf(FMT_STR_PID_TOP_USAGE, i + 1, target.rchar,
+                                           target.wchar, target.readBytes, target.writeBytes,
+                                           target.cancelledWriteBytes, target.pid, target.uid,
+                                           target.name);
+    }
+}
+
 void ScopeTimer::dump(std::string *outAppend) {
     auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
         std::chrono::system_clock::now() - mStart);
@@ -407,12 +815,44 @@ void ScopeTimer::dump(std::string *outAppend) {
  *     iostats.read.min : skip dump when READ amount is lower than the value
  *     iostats.write.min : skip dump when WRITE amount is lower than the value
  *     iostats.debug : 1 - to enable debug log; 0 - disabled
+ *     iostats.disabled : 1 - to stop collecting; 0 - enabled
+ *     iostats.topcount : number of UIDs listed per ranking
+ *     iostats.rank : comma separated rankings to dump, any of
+ *                    read,write,fsync,fgread,bgread,fgwrite,bgwrite (default: read,write)
+ *     iostats.burst.rate : report UIDs doing more IO than this many bytes/s; 0 to disable
+ *     iostats.burst.duration : seconds the burst rate must be sustained before reporting
+ *     iostats.pid.uids : comma separated UIDs whose processes are listed from /proc/<pid>/io,
+ *                        e.g. "0,1000"; empty to disable (default)
+ *     iostats.scan.pids : read at most this many new /proc/<pid>/status per tick; 0 - no limit
+ *     iostats.scan.us : stop reading new /proc/<pid>/status after this many us; 0 - no limit
+ *     iostats.anomaly.sigma : list the rankings only for intervals this many standard
+ *                             deviations above the recent R/W baseline (default: 3);
+ *                             0 to use the iostats.*min thresholds instead
  */
 void IoUsage::setOptions(const std::string &key, const std::string &value) {
     std::stringstream out;
     out << "set IO options: " << key << " , " << value;
+    if (key == "iostats.pid.uids") {
+        if (!mPidStats.setUids(value)) {
+            LOG_TO(SYSTEM, ERROR) << out.str() << ": Failed";
+            return;
+        }
+        LOG_TO(SYSTEM, INFO) << out.str() << ": Success";
+        return;
+    }
+    if (key == "iostats.rank") {
+        if (!mStats.setRankKeys(value)) {
+            LOG_TO(SYSTEM, ERROR) << out.str() << ": Failed";
+            return;
+        }
+        LOG_TO(SYSTEM, INFO) << out.str() << ": Success";
+        return;
+    }
     if (key == "iostats.min" || key == "iostats.read.min" || key == "iostats.write.min" ||
-        key == "iostats.debug") {
+        key == "iostats.debug" || key == "iostats.disabled" || key == "iostats.topcount" ||
+        key == "iostats.burst.rate" || key == "iostats.burst.duration" ||
+        key == "iostats.anomaly.sigma" || key == "iostats.scan.pids" ||
+        key == "iostats.scan.us") {
         uint64_t val = 0;
         if (!android::base::ParseUint(value, &val)) {
             out << "!!!! unable to parse value to uint64";
@@ -430,6 +870,21 @@ void IoUsage::setOptions(const std::string &key, const std::string &value) {
             mStats.setDumpThresholdSizeForWrite(val);
         } else if (key == "iostats.debug") {
             sOptDebug = (val != 0);
+        } else if (key == "iostats.topcount") {
+            mStats.setTopCount(val);
+            mPidStats.setTopCount(val);
+        } else if (key == "iostats.burst.rate") {
+            mStats.setBurstRate(val);
+        } else if (key == "iostats.burst.duration") {
+            mStats.setBurstDuration(val);
+        } else if (key == "iostats.anomaly.sigma") {
+            mStats.setAnomalySigma(val);
+        } else if (key == "iostats.scan.pids") {
+            mScanPids = val;
+            mStats.setScanBudget(mScanPids, mScanUs);
+        } else if (key == "iostats.scan.us") {
+            mScanUs = val;
+            mStats.setScanBudget(mScanPids, mScanUs);
         }
         LOG_TO(SYSTEM, INFO) << out.str() << ": Success";
     }
@@ -440,26 +895,26 @@ void IoUsage::refresh(void) {
         return;
     ScopeTimer _debugTimer("refresh");
     _debugTimer.setEnabled(sOptDebug);
-    std::string buffer;
-    if (!android::base::ReadFileToString(UID_IO_STATS_PATH, &buffer)) {
-        LOG_TO(SYSTEM, ERROR) << UID_IO_STATS_PATH << ": ReadFileToString failed";
+    if (!readFileToBuffer(UID_IO_STATS_PATH, &mBuffer)) {
+        LOG_TO(SYSTEM, ERROR) << UID_IO_STATS_PATH << ": read failed";
     }
     if (sOptDebug)
         LOG_TO(SYSTEM, INFO) << "read " << UID_IO_STATS_PATH << " OK.";
-    std::vector<std::string> lines = android::base::Split(std::move(buffer), "\n");
-    std::unordered_map<uint32_t, UserIo> datas;
-    for (uint32_t i = 0; i < lines.size(); i++) {
-        if (lines[i].empty()) {
-            continue;
-        }
-        UserIo data;
-        if (!loadDataFromLine(std::move(lines[i]), data))
-            continue;
-        datas[data.uid] = data;
+    parseUidIoStats(mBuffer, &mUidIo);
+    std::chrono::system_clock::time_point now = std::chrono::system_clock::now();
+    if (mStats.calcAll(&mUidIo)) {
+        mDiffTick = tick();
+        const UserIo &total = mStats.getTotal();
+        float metrics[] = {total.sumRead() / 1000000.0f, total.sumWrite() / 1000000.0f,
+                           static_cast<float>(total.sumFsync())};
+        appendMetrics(now, metrics);
+        record(mReadHistogram, total.sumRead());
+        record(mWriteHistogram, total.sumWrite());
     }
-    mStats.calcAll(std::move(datas));
+    mPidStats.refresh();
     std::stringstream out;
     mStats.dump(&out);
+    mPidStats.dump(&out);
     const std::string &str = out.str();
     if (sOptDebug) {
         LOG_TO(SYSTEM, INFO) << str;
@@ -0,0 +1,98 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "log_histogram.h"
+#include <android-base/stringprintf.h>
+#include <algorithm>
+
+using namespace android::pixel::perfstatsd;
+
+static constexpr uint64_t SUB_COUNT = 1ULL << HISTOGRAM_SUB_BITS;
+static constexpr uint64_t HALF_COUNT = SUB_COUNT >> 1;
+
+static constexpr char FMT_SUMMARY[] = "[%s.%s %s] p50:%.2f p90:%.2f p99:%.2f max:%.2f n:%zu\n";
+
+LogHistogram::LogHistogram(const std::string &name, const char *unit, double divisor)
+    : mName(name), mUnit(unit), mDivisor(divisor), mHead(0), mCount(0) {
+    std::fill(mCounts, mCounts + HISTOGRAM_BUCKETS, 0);
+}
+
+uint16_t LogHistogram::bucketOf(uint64_t value) {
+    if (value < SUB_COUNT) {
+        return value;
+    }
+    // The top HISTOGRAM_SUB_BITS bits of |value| pick the bucket
+    int shift = 63 - __builtin_clzll(value) - (HISTOGRAM_SUB_BITS - 1);
+    return SUB_COUNT + (shift - 1) * HALF_COUNT + ((value >> shift) - HALF_COUNT);
+}
+
+uint64_t LogHistogram::upperBound(uint16_t bucket) {
+    if (bucket < SUB_COUNT) {
+        return bucket;
+    }
+    int shift = (bucket - SUB_COUNT) / HALF_COUNT + 1;
+    uint64_t top = (bucket - SUB_COUNT) % HALF_COUNT + HALF_COUNT;
+    return ((top + 1) << shift) - 1;
+}
+
+void LogHistogram::add(uint64_t value) {
+    uint16_t bucket = bucketOf(value);
+    if (mCount == HISTOGRAM_WINDOW) {
+        mCounts[mRing[mHead]]--;
+    } else {
+        mCount++;
+    }
+    mRing[mHead] = bucket;
+    mHead = (mHead + 1) % HISTOGRAM_WINDOW;
+    mCounts[bucket]++;
+}
+
+uint64_t LogHistogram::percentile(double p) const {
+    if (mCount == 0) {
+        return 0;
+    }
+    size_t rank = std::max<size_t>(1, static_cast<size_t>(p / 100.0 * mCount + 0.5));
+    size_t seen = 0;
+    for (int b = 0; b < HISTOGRAM_BUCKETS; b++) {
+        seen += mCounts[b];
+        if (seen >= rank) {
+            return upperBound(b);
+        }
+    }
+    return max();
+}
+
+uint64_t LogHistogram::max() const {
+    for (int b = HISTOGRAM_BUCKETS - 1; b >= 0; b--) {
+        if (mCounts[b] > 0) {
+            return upperBound(b);
+        }
+    }
+    return 0;
+}
+
+/* Summary of the window (Sample Log)
+ *
+ * [cpu.cpu0 %] p50:12.50 p90:48.00 p99:91.00 max:97.00 n:180
+ */
+void LogHistogram::summary(const std::string &collector, std::string *out) const {
+    if (mCount == 0) {
+        return;
+    }
+    out->append(android::base::StringPrintf(FMT_SUMMARY, collector.c_str(), mName.c_str(), mUnit,
+                                            percentile(50) / mDivisor, percentile(90) / mDivisor,
+                                            percentile(99) / mDivisor, max() / mDivisor, mCount));
+}
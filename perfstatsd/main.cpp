@@ -19,7 +19,7 @@
 #include <perfstatsd.h>
 #include <perfstatsd_service.h>
 
-enum MODE { DUMP_HISTORY, SET_OPTION };
+enum MODE { DUMP_HISTORY, SET_OPTION, WATCH };
 
 android::sp<Perfstatsd> perfstatsdSp;
 
@@ -36,11 +36,13 @@ void *perfstatsdMain(void *) {
 
 void help(char **argv) {
     std::string usage = argv[0];
-    usage = "Usage: " + usage + " [-s][-d][-o]\n" +
+    usage = "Usage: " + usage + " [-s][-d][-o][-w]\n" +
             "Options:\n"
             "    -s, start as service\n"
-            "    -d, dump perf stats history for dumpstate_board\n"
-            "    -o, set key/value option";
+            "    -d, dump perf stats history for dumpstate_board, optionally of tier 1 (1 min\n"
+            "        min/avg/max for 24 h) or tier 2 (10 min for 7 days)\n"
+            "    -o, set key/value option\n"
+            "    -w, stream new samples, optionally of comma separated collectors only";
 
     fprintf(stderr, "%s\n", usage.c_str());
 }
@@ -69,6 +71,18 @@ int startService(void) {
     return 0;
 }
 
+class PrintCallback : public BnPerfstatsdCallback {
+  public:
+    android::binder::Status onSamples(const std::vector<std::string> &samples,
+                                      int32_t dropped) override {
+        if (dropped > 0)
+            fprintf(stdout, "(%d samples dropped)\n", dropped);
+        for (const auto &sample : samples) fprintf(stdout, "%s", sample.c_str());
+        fflush(stdout);
+        return android::binder::Status::ok();
+    }
+};
+
 int serviceCall(int mode, const std::string &key, const std::string &value) {
     android::ProcessState::initWithDriver("/dev/vndbinder");
 
@@ -83,7 +97,17 @@ int serviceCall(int mode, const std::string &key, const std::string &value) {
         case DUMP_HISTORY: {
             std::string history;
             LOG_TO(SYSTEM, INFO) << "dump perfstats history.";
-            if (!perfstatsdPrivateService->dumpHistory(&history).isOk() || history.empty()) {
+            // |key| holds the archive tier, empty for the raw samples
+            int tier = ARCHIVE_TIER_RAW;
+            if (!key.empty() && !android::base::ParseInt(key, &tier)) {
+                fprintf(stdout, "invalid tier: %s\n", key.c_str());
+                return -1;
+            }
+            android::binder::Status status = tier == ARCHIVE_TIER_RAW
+                                                 ? perfstatsdPrivateService->dumpHistory(&history)
+                                                 : perfstatsdPrivateService->dumpHistoryTier(
+                                                       tier, &history);
+            if (!status.isOk() || history.empty()) {
                 PLOG_TO(SYSTEM, ERROR) << "perf stats history is not available";
                 fprintf(stdout, "perf stats history is not available\n");
                 return -1;
@@ -102,6 +126,18 @@ int serviceCall(int mode, const std::string &key, const std::string &value) {
                 return -1;
             }
             break;
+        case WATCH: {
+            // |key| holds the collector filter
+            android::sp<PrintCallback> callback = new PrintCallback();
+            if (!perfstatsdPrivateService->registerCallback(callback, key).isOk()) {
+                PLOG_TO(SYSTEM, ERROR) << "fail to register callback";
+                fprintf(stdout, "fail to register callback\n");
+                return -1;
+            }
+            android::ProcessState::self()->startThreadPool();
+            android::IPCThreadState::self()->joinThreadPool();
+            break;
+        }
     }
     return 0;
 }
@@ -113,12 +149,20 @@ int serviceCall(int mode) {
 
 int main(int argc, char **argv) {
     int c;
-    while ((c = getopt(argc, argv, "sdo:h")) != -1) {
+    while ((c = getopt(argc, argv, "sdo:wh")) != -1) {
         switch (c) {
             case 's':
                 return startService();
-            case 'd':
-                return serviceCall(DUMP_HISTORY);
+            case 'd': {
+                std::string tier(argc == 3 ? argv[2] : "");
+                std::string empty("");
+                return serviceCall(DUMP_HISTORY, tier, empty);
+            }
+            case 'w': {
+                std::string collectors(argc == 3 ? argv[2] : "");
+                std::string empty("");
+                return serviceCall(WATCH, collectors, empty);
+            }
             case 'o':
                 // set options
                 if (argc == 4) {
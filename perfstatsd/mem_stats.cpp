@@ -0,0 +1,240 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "perfstatsd_mem"
+
+#include "mem_stats.h"
+#include <android-base/stringprintf.h>
+#include <unistd.h>
+#include <algorithm>
+#include "text_parser.h"
+
+using namespace android::pixel::perfstatsd;
+
+static constexpr char FMT_MEM[] = "[MEM] %zu processes, %zu smaps_rollup read\n";
+static constexpr char FMT_MEM_TOP[] =
+    "[MEM_TOP%zu] %5u %-16.*s rss:%" PRIu64 "MB pss:%" PRIu64 "MB anon:%" PRIu64
+    "MB file:%" PRIu64 "MB shmem:%" PRIu64 "MB swap:%" PRIu64 "MB trend:%+.2fMB/min\n";
+static constexpr char FMT_MEM_TOP_NO_PSS[] = "[MEM_TOP%zu] %5u %-16.*s rss:%" PRIu64 "MB pss:-\n";
+
+static bool cDebug = false;
+
+MemStats::MemStats(const sp<ProcSnapshot> &snapshot)
+    : mProcSnapshot(snapshot),
+      mDisabled(false),
+      mTopCount(MEM_TOP_DEFAULT),
+      mRssThreshold(MEM_RSS_THRESHOLD_DEFAULT) {
+    mStart = std::chrono::steady_clock::now();
+    mPageKb = sysconf(_SC_PAGESIZE) / 1024;
+}
+
+/*
+ * setOptions - MemStats supports following options
+ *     memstats.topcount : number of processes listed, by RSS
+ *     memstats.rss.threshold : KB of RSS change before smaps_rollup is read again
+ *     memstats.disabled : 1 - to stop collecting; 0 - enabled
+ *     memstats.debug : 1 - to enable debug log; 0 - disabled
+ */
+void MemStats::setOptions(const std::string &key, const std::string &value) {
+    if (key == MEMSTATS_TOPCOUNT || key == MEMSTATS_RSS_THRESHOLD || key == MEMSTATS_DISABLED ||
+        key == MEMSTATS_DEBUG) {
+        uint32_t val = 0;
+        if (!base::ParseUint(value, &val)) {
+            LOG_TO(SYSTEM, ERROR) << "Invalid value: " << value;
+            return;
+        }
+        if (key == MEMSTATS_TOPCOUNT) {
+            mTopCount = val;
+            LOG_TO(SYSTEM, INFO) << "set top count " << mTopCount;
+        } else if (key == MEMSTATS_RSS_THRESHOLD) {
+            mRssThreshold = val;
+            LOG_TO(SYSTEM, INFO) << "set rss threshold " << mRssThreshold << " KB";
+        } else if (key == MEMSTATS_DISABLED) {
+            mDisabled = (val != 0);
+            LOG_TO(SYSTEM, INFO) << "set disabled " << mDisabled;
+        } else {
+            cDebug = (val != 0);
+            LOG_TO(SYSTEM, INFO) << "set debug " << cDebug;
+        }
+    }
+}
+
+/*
+ * Parse /proc/<pid>/smaps_rollup, e.g.
+ *   00400000-7fff87d1e000 ---p 00000000 00:00 0                  [rollup]
+ *   Rss:              103204 kB
+ *   Pss:               41265 kB
+ *   Pss_Anon:          30124 kB
+ *   Pss_File:          10712 kB
+ *   Pss_Shmem:           429 kB
+ *   ...
+ *   SwapPss:            5120 kB
+ * Pss_Anon/File/Shmem exist since kernel 5.9; they stay 0 before that.
+ */
+bool MemStats::readRollup(uint32_t pid, MemRollup *rollup) {
+    char path[48];
+    snprintf(path, sizeof(path), "/proc/%u/smaps_rollup", pid);
+    if (!readFileToBuffer(path, &mBuffer)) {
+        return false;
+    }
+    *rollup = {};
+    TextScanner scanner(mBuffer);
+    for (; !scanner.atEnd(); scanner.nextLine()) {
+        if (scanner.consume("Rss:")) {
+            scanner.parseUint(&rollup->rss);
+        } else if (scanner.consume("Pss:")) {
+            scanner.parseUint(&rollup->pss);
+        } else if (scanner.consume("Pss_Anon:")) {
+            scanner.parseUint(&rollup->pssAnon);
+        } else if (scanner.consume("Pss_File:")) {
+            scanner.parseUint(&rollup->pssFile);
+        } else if (scanner.consume("Pss_Shmem:")) {
+            scanner.parseUint(&rollup->pssShmem);
+        } else if (scanner.consume("SwapPss:")) {
+            scanner.parseUint(&rollup->swapPss);
+        }
+    }
+    // Kernel threads have an empty rollup
+    return rollup->rss > 0;
+}
+
+// Least squares slope of the PSS samples, in MB per minute
+float MemStats::trend(const MemProc &proc) const {
+    if (proc.trendCount < 2)
+        return 0.0f;
+    double meanT = 0, meanP = 0;
+    for (size_t i = 0; i < proc.trendCount; i++) {
+        meanT += proc.trendMs[i];
+        meanP += proc.trendPss[i];
+    }
+    meanT /= proc.trendCount;
+    meanP /= proc.trendCount;
+    double num = 0, den = 0;
+    for (size_t i = 0; i < proc.trendCount; i++) {
+        double dt = proc.trendMs[i] - meanT;
+        num += dt * (proc.trendPss[i] - meanP);
+        den += dt * dt;
+    }
+    // KB per ms to MB per minute
+    return den > 0 ? num / den * 60000.0 / 1024.0 : 0.0f;
+}
+
+/* Dump the largest processes, one line each; pss:- when smaps_rollup can't be read (Sample Log)
+ *
+ * [MEM] 612 processes, 2 smaps_rollup read
+ * [MEM_TOP1]  1520 system_server    rss:412MB pss:301MB anon:221MB file:74MB shmem:6MB
+ *     swap:40MB trend:+0.12MB/min
+ * [MEM_TOP2]   871 surfaceflinger   rss:198MB pss:-
+ */
+void MemStats::refresh(void) {
+    if (mDisabled)
+        return;
+
+    std::chrono::system_clock::time_point now = std::chrono::system_clock::now();
+    int64_t awakeMs = std::chrono::duration_cast<std::chrono::milliseconds>(
+                          std::chrono::steady_clock::now() - mStart)
+                          .count();
+    const std::vector<uint32_t> &pids = mProcSnapshot->getPids();
+    mRss.clear();
+    for (uint32_t pid : pids) {
+        const std::string *stat = mProcSnapshot->getStat(pid);
+        if (stat == nullptr)
+            continue;
+        // rss is field 24, counted after the comm that may contain spaces
+        size_t close = stat->rfind(')');
+        if (close == std::string::npos)
+            continue;
+        TextScanner scanner(std::string_view(*stat).substr(close + 1));
+        uint64_t rss = 0;
+        bool valid = true;
+        for (int i = 3; i < 24 && valid; i++) valid = scanner.skipToken();
+        if (!valid || !scanner.parseUint(&rss) || rss == 0)
+            continue;
+        mRss.emplace_back(rss * mPageKb, pid);
+    }
+    size_t count = std::min<size_t>(mTopCount, mRss.size());
+    std::partial_sort(mRss.begin(), mRss.begin() + count, mRss.end(),
+                      std::greater<std::pair<uint64_t, uint32_t>>());
+
+    // Forget processes that exited
+    for (auto it = mProcs.begin(); it != mProcs.end();) {
+        if (!std::binary_search(pids.begin(), pids.end(), it->first))
+            it = mProcs.erase(it);
+        else
+            ++it;
+    }
+
+    size_t reads = 0;
+    size_t rank = 0;
+    std::string top;
+    for (size_t i = 0; i < count; i++) {
+        uint64_t rss = mRss[i].first;
+        uint32_t pid = mRss[i].second;
+        const ProcIdentity *identity = mProcSnapshot->getIdentity(pid);
+        if (identity == nullptr)
+            continue;
+        const std::string &name = identity->comm;
+        uint64_t starttime = identity->starttime;
+
+        auto it = mProcs.find(pid);
+        if (it != mProcs.end() && it->second.starttime != starttime) {
+            mProcs.erase(it);  // the pid was reused
+            it = mProcs.end();
+        }
+        MemProc *proc = it == mProcs.end() ? nullptr : &it->second;
+        uint64_t moved = proc == nullptr ? 0
+                         : rss > proc->readRss ? rss - proc->readRss
+                                                : proc->readRss - rss;
+        if (proc == nullptr || (!proc->rollupFailed && moved > mRssThreshold)) {
+            MemRollup rollup;
+            bool read = readRollup(pid, &rollup);
+            if (proc == nullptr) {
+                proc = &mProcs[pid];
+                proc->starttime = starttime;
+                proc->trendHead = 0;
+                proc->trendCount = 0;
+            }
+            // Denied or empty for this lifetime of the process, not retried
+            proc->rollupFailed = !read;
+            if (read) {
+                reads++;
+                proc->readRss = rss;
+                proc->rollup = rollup;
+            }
+        }
+        if (proc->rollupFailed) {
+            top.append(android::base::StringPrintf(FMT_MEM_TOP_NO_PSS, ++rank, pid,
+                                                    static_cast<int>(name.size()),
+                                                    name.data(), rss / 1024));
+            continue;
+        }
+        proc->trendMs[proc->trendHead] = awakeMs;
+        proc->trendPss[proc->trendHead] = proc->rollup.pss;
+        proc->trendHead = (proc->trendHead + 1) % MEM_TREND_SAMPLES;
+        proc->trendCount = std::min<size_t>(proc->trendCount + 1, MEM_TREND_SAMPLES);
+
+        const MemRollup &r = proc->rollup;
+        top.append(android::base::StringPrintf(
+            FMT_MEM_TOP, ++rank, pid, static_cast<int>(name.size()), name.data(), rss / 1024,
+            r.pss / 1024, r.pssAnon / 1024, r.pssFile / 1024, r.pssShmem / 1024,
+            r.swapPss / 1024, trend(*proc)));
+    }
+    std::string out = android::base::StringPrintf(FMT_MEM, mRss.size(), reads);
+    out.append(top);
+    if (cDebug)
+        LOG_TO(SYSTEM, INFO) << out;
+    append(now, out);
+}
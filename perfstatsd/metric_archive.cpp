@@ -0,0 +1,116 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "metric_archive.h"
+#include <android-base/stringprintf.h>
+#include <time.h>
+
+using namespace android::pixel::perfstatsd;
+
+struct TierConfig {
+    std::chrono::seconds step;
+    size_t slots;
+};
+
+// Indexed by tier; the raw tier lives in the PerfstatsBuffer of each collector
+static const TierConfig TIER_CONFIGS[ARCHIVE_TIER_MAX] = {
+    {std::chrono::seconds(0), 0},
+    {std::chrono::minutes(1), 24 * 60},   // 24 h
+    {std::chrono::minutes(10), 7 * 144},  // 7 days
+};
+
+static constexpr char FMT_AGGREGATE[] = " %s:%.2f/%.2f/%.2f";
+
+void MetricArchive::setMetrics(const std::vector<std::string> &names) {
+    mNames = names;
+    for (int i = 0; i < ARCHIVE_TIER_MAX; i++) {
+        Tier &tier = mTiers[i];
+        tier.step = TIER_CONFIGS[i].step;
+        tier.slots = TIER_CONFIGS[i].slots;
+        tier.times.assign(tier.slots, std::chrono::system_clock::time_point());
+        tier.buckets.assign(tier.slots * names.size(), MetricAggregate());
+        tier.open.assign(names.size(), MetricAggregate());
+        for (auto &bucket : tier.open) bucket.reset();
+        tier.head = 0;
+        tier.count = 0;
+        tier.openStart = std::chrono::system_clock::time_point();
+    }
+}
+
+void MetricArchive::close(Tier *tier) {
+    if (tier->open.empty() || tier->open[0].count == 0) {
+        return;
+    }
+    tier->times[tier->head] = tier->openStart;
+    std::copy(tier->open.begin(), tier->open.end(),
+              tier->buckets.begin() + tier->head * mNames.size());
+    tier->head = (tier->head + 1) % tier->slots;
+    tier->count = std::min(tier->count + 1, tier->slots);
+    for (auto &bucket : tier->open) bucket.reset();
+}
+
+void MetricArchive::add(std::chrono::system_clock::time_point time, const float *values) {
+    for (int i = ARCHIVE_TIER_RAW + 1; i < ARCHIVE_TIER_MAX; i++) {
+        Tier &tier = mTiers[i];
+        if (tier.slots == 0) {
+            continue;
+        }
+        // Buckets are aligned to wall clock steps, e.g. whole minutes
+        auto sinceEpoch =
+            std::chrono::duration_cast<std::chrono::seconds>(time.time_since_epoch());
+        std::chrono::system_clock::time_point start(sinceEpoch - sinceEpoch % tier.step);
+        if (start != tier.openStart) {
+            close(&tier);
+            tier.openStart = start;
+        }
+        for (size_t m = 0; m < mNames.size(); m++) {
+            tier.open[m].add(values[m]);
+        }
+    }
+}
+
+void MetricArchive::dumpBucket(std::chrono::system_clock::time_point time,
+                               const MetricAggregate *buckets, std::string *out) const {
+    time_t t = std::chrono::system_clock::to_time_t(time);
+    char buff[20];
+    strftime(buff, sizeof(buff), "%m-%d %H:%M:%S", localtime(&t));
+    out->append(buff);
+    for (size_t m = 0; m < mNames.size(); m++) {
+        out->append(android::base::StringPrintf(FMT_AGGREGATE, mNames[m].c_str(), buckets[m].min,
+                                                buckets[m].avg(), buckets[m].max));
+    }
+    out->append("\n");
+}
+
+/* Dump one tier, oldest bucket first, as name:min/avg/max (Sample Log)
+ *
+ * 05-12 10:31:00 total:12.40/25.31/60.10 user:8.20/17.02/41.88
+ */
+void MetricArchive::dump(int tier, std::string *out) const {
+    if (tier <= ARCHIVE_TIER_RAW || tier >= ARCHIVE_TIER_MAX || mNames.empty()) {
+        return;
+    }
+    const Tier &t = mTiers[tier];
+    size_t first = (t.head + t.slots - t.count) % t.slots;
+    for (size_t i = 0; i < t.count; i++) {
+        size_t slot = (first + i) % t.slots;
+        dumpBucket(t.times[slot], &t.buckets[slot * mNames.size()], out);
+    }
+    // The bucket still being filled
+    if (!t.open.empty() && t.open[0].count > 0) {
+        dumpBucket(t.openStart, t.open.data(), out);
+    }
+}
@@ -0,0 +1,166 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "perfstatsd_net"
+
+#include "net_stats.h"
+#include <android-base/stringprintf.h>
+#include <fcntl.h>
+#include <algorithm>
+#include <cstring>
+#include "text_parser.h"
+
+using namespace android::pixel::perfstatsd;
+
+static constexpr const char *NET_DEV_PATH = "/proc/net/dev";
+static constexpr char FMT_NET[] = "[NET %s: %lld.%03llds] RX:%.1fKB/s,%.1fpkt/s,drop:%" PRIu64
+                                  " TX:%.1fKB/s,%.1fpkt/s,drop:%" PRIu64 "\n";
+
+static bool cDebug = false;
+
+static bool nameLess(const NetIface &a, const NetIface &b) {
+    return strncmp(a.name, b.name, IFNAMSIZ) < 0;
+}
+
+static float perSecond(uint64_t diff, uint64_t ms) {
+    return ms ? diff * 1000.0f / ms : 0.0f;
+}
+
+NetStats::NetStats(void) : mDisabled(false) {
+    mLast = std::chrono::steady_clock::now();
+}
+
+/*
+ * setOptions - NetStats supports following options
+ *     netstats.disabled : 1 - to stop collecting; 0 - enabled
+ *     netstats.debug : 1 - to enable debug log; 0 - disabled
+ */
+void NetStats::setOptions(const std::string &key, const std::string &value) {
+    if (key == NETSTATS_DISABLED || key == NETSTATS_DEBUG) {
+        uint32_t val = 0;
+        if (!base::ParseUint(value, &val)) {
+            LOG_TO(SYSTEM, ERROR) << "Invalid value: " << value;
+            return;
+        }
+        if (key == NETSTATS_DISABLED) {
+            mDisabled = (val != 0);
+            LOG_TO(SYSTEM, INFO) << "set disabled " << mDisabled;
+        } else {
+            cDebug = (val != 0);
+            LOG_TO(SYSTEM, INFO) << "set debug " << cDebug;
+        }
+    }
+}
+
+/*
+ * Parse /proc/net/dev, e.g.
+ * Inter-|   Receive                                                |  Transmit
+ *  face |bytes    packets errs drop fifo frame compressed multicast|bytes    packets errs drop ...
+ *  wlan0: 81236912   70211    0    0    0     0          0         0 9120331   51092    0    0 ...
+ */
+void NetStats::parseNetDev(std::string_view text, std::vector<NetIface> *out) {
+    out->clear();
+    TextScanner scanner(text);
+    for (; !scanner.atEnd(); scanner.nextLine()) {
+        scanner.skipSpaces();
+        std::string_view line = scanner.restOfLine();
+        size_t colon = line.find(':');
+        // Header lines have no colon; the name may touch the first counter
+        if (colon == std::string_view::npos || colon == 0 || colon >= IFNAMSIZ ||
+            !scanner.skipPast(':')) {
+            continue;
+        }
+        NetIface iface = {};
+        memcpy(iface.name, line.data(), colon);
+        uint64_t unused;
+        if (!scanner.parseUint(&iface.rxBytes) || !scanner.parseUint(&iface.rxPackets) ||
+            !scanner.parseUint(&unused) || !scanner.parseUint(&iface.rxDrops) ||
+            !scanner.parseUint(&unused) || !scanner.parseUint(&unused) ||
+            !scanner.parseUint(&unused) || !scanner.parseUint(&unused) ||
+            !scanner.parseUint(&iface.txBytes) || !scanner.parseUint(&iface.txPackets) ||
+            !scanner.parseUint(&unused) || !scanner.parseUint(&iface.txDrops)) {
+            if (cDebug)
+                LOG_TO(SYSTEM, WARNING) << "Invalid line: " << line;
+            continue;
+        }
+        out->push_back(iface);
+    }
+    if (!std::is_sorted(out->begin(), out->end(), nameLess)) {
+        std::sort(out->begin(), out->end(), nameLess);
+    }
+}
+
+bool NetStats::readStats(void) {
+    if (mFd < 0) {
+        mFd.reset(TEMP_FAILURE_RETRY(open(NET_DEV_PATH, O_RDONLY | O_CLOEXEC)));
+        if (mFd < 0) {
+            PLOG_TO(SYSTEM, ERROR) << "Fail to open " << NET_DEV_PATH;
+            return false;
+        }
+    }
+    if (!readFdToBuffer(mFd, &mBuffer)) {
+        PLOG_TO(SYSTEM, ERROR) << "Fail to read " << NET_DEV_PATH;
+        mFd.reset();
+        return false;
+    }
+    parseNetDev(mBuffer, &mCurrent);
+    return true;
+}
+
+/* Dump interfaces that moved data (Sample Log)
+ *
+ * [NET wlan0: 10.001s] RX:812.4KB/s,702.1pkt/s,drop:0 TX:91.2KB/s,510.9pkt/s,drop:0
+ */
+void NetStats::refresh(void) {
+    if (mDisabled)
+        return;
+
+    std::chrono::system_clock::time_point now = std::chrono::system_clock::now();
+    std::chrono::steady_clock::time_point awake = std::chrono::steady_clock::now();
+    if (!readStats()) {
+        mPrevious.clear();
+        return;
+    }
+    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(awake - mLast);
+    uint64_t interval = ms.count();
+    std::string out;
+    auto prev = mPrevious.begin();
+    for (const NetIface &curr : mCurrent) {
+        while (prev != mPrevious.end() && nameLess(*prev, curr)) ++prev;
+        // New interfaces, and ones whose counters were reset, start next tick
+        if (prev == mPrevious.end() || nameLess(curr, *prev) || curr.rxBytes < prev->rxBytes ||
+            curr.txBytes < prev->txBytes) {
+            continue;
+        }
+        uint64_t rxBytes = curr.rxBytes - prev->rxBytes;
+        uint64_t txBytes = curr.txBytes - prev->txBytes;
+        if (rxBytes == 0 && txBytes == 0)
+            continue;
+        out.append(android::base::StringPrintf(
+            FMT_NET, curr.name, ms.count() / 1000, ms.count() % 1000,
+            perSecond(rxBytes, interval) / 1024,
+            perSecond(curr.rxPackets - prev->rxPackets, interval), curr.rxDrops - prev->rxDrops,
+            perSecond(txBytes, interval) / 1024,
+            perSecond(curr.txPackets - prev->txPackets, interval), curr.txDrops - prev->txDrops));
+    }
+    mPrevious.swap(mCurrent);
+    mLast = awake;
+    if (out.empty())
+        return;
+    if (cDebug)
+        LOG_TO(SYSTEM, INFO) << out;
+    append(now, out);
+}
@@ -16,50 +16,286 @@
 
 #define LOG_TAG "perfstatsd"
 
+#include <android-base/stringprintf.h>
+#include <android-base/strings.h>
 #include <perfstatsd.h>
 
 using namespace android::pixel::perfstatsd;
 
+static constexpr char FMT_SUSPEND[] = "[SUSPEND] suspended for %lld.%03llds";
+
+static void formatSample(const StatsData &data, std::string *out) {
+    auto raw_time = data.getTime();
+    auto seconds = std::chrono::time_point_cast<std::chrono::seconds>(raw_time);
+    auto d = raw_time - seconds;
+    auto milliseconds = std::chrono::duration_cast<std::chrono::milliseconds>(d);
+    std::string content = data.getData();
+
+    time_t t = std::chrono::system_clock::to_time_t(raw_time);
+    char buff[20];
+    strftime(buff, sizeof(buff), "%m-%d %H:%M:%S", localtime(&t));
+
+    out->append(std::string(buff) + ".");
+    out->append(std::to_string(milliseconds.count()) + "\n");
+    out->append(content + "\n");
+}
+
 Perfstatsd::Perfstatsd(void) {
     mRefreshPeriod = DEFAULT_DATA_COLLECT_PERIOD;
+    mProcSnapshot = new ProcSnapshot();
+    mEvents.reset(new EventLog());
+    mEvents->setBufferSize(EVENT_LOG_BUFFER_SIZE);
+    mEvents->setName("events");
+    loadConfig(PERFSTATSD_CONFIG_PATH);
+}
+
+/* Record suspend gaps (Sample Log)
+ *
+ * [SUSPEND] suspended for 3541.207s
+ */
+void Perfstatsd::pause(void) {
+    mSampler.wait(mRefreshPeriod);
+    auto ms = mSampler.suspended().count();
+    if (ms == 0)
+        return;
+    std::string out = android::base::StringPrintf(FMT_SUSPEND, ms / 1000, ms % 1000);
+    std::unique_lock<std::mutex> mlock(mStatsMutex);
+    mEvents->record(out);
+}
+
+/*
+ * The config holds one "key value" option per line, the same as
+ * "perfstatsd -o key value"; lines starting with '#' are comments, e.g.
+ *   perfstatsd.collectors cpu,io
+ *   io.period 30
+ *   cpu.buffer 360
+ *   iostats.topcount 3
+ * Only the collectors in perfstatsd.collectors are created (default: cpu,io).
+ */
+void Perfstatsd::loadConfig(const char *path) {
+    std::vector<std::pair<std::string, std::string>> options;
+    std::string collectors;
+    std::string config;
+    if (android::base::ReadFileToString(path, &config)) {
+        for (const auto &raw : android::base::Split(config, "\n")) {
+            std::string line = android::base::Trim(raw);
+            if (line.empty() || line[0] == '#')
+                continue;
+            size_t sep = line.find_first_of(" \t");
+            if (sep == std::string::npos) {
+                LOG_TO(SYSTEM, ERROR) << path << ": no value in \"" << line << "\"";
+                continue;
+            }
+            std::string key = line.substr(0, sep);
+            std::string value = android::base::Trim(line.substr(sep));
+            if (key == PERFSTATSD_COLLECTORS)
+                collectors = value;
+            else
+                options.emplace_back(key, value);
+        }
+        LOG_TO(SYSTEM, INFO) << "loaded " << path;
+    }
+    setCollectors(collectors);
+    for (const auto &option : options) {
+        setOptions(option.first, option.second);
+    }
+}
+
+StatsType *Perfstatsd::findStats(const std::string &name) {
+    for (auto const &stats : mStats) {
+        if (stats->getName() == name)
+            return stats.get();
+    }
+    return nullptr;
+}
 
-    std::unique_ptr<StatsType> cpuUsage(new CpuUsage);
-    cpuUsage->setBufferSize(CPU_USAGE_BUFFER_SIZE);
-    mStats.emplace_back(std::move(cpuUsage));
+/*
+ * Create the listed collectors that don't exist yet, in registry order, and
+ * pause the unlisted ones. Collectors are never destroyed since others may
+ * hold on to them. Called with mStatsMutex held, or from the constructor.
+ */
+void Perfstatsd::setCollectors(const std::string &names) {
+    std::vector<std::string> wanted;
+    for (const auto &name : android::base::Split(names, ",")) {
+        if (!name.empty())
+            wanted.push_back(name);
+    }
+    if (wanted.empty())
+        wanted = android::base::Split(PERFSTATSD_COLLECTORS_DEFAULT, ",");
+    CollectorContext context;
+    context.snapshot = mProcSnapshot;
+    context.find = [this](const std::string &name) { return findStats(name); };
 
-    std::unique_ptr<StatsType> ioUsage(new IoUsage);
-    ioUsage->setBufferSize(IO_USAGE_BUFFER_SIZE);
-    mStats.emplace_back(std::move(ioUsage));
+    auto it = mStats.begin();
+    for (const CollectorInfo &info : getCollectorRegistry()) {
+        bool listed = std::find(wanted.begin(), wanted.end(), info.name) != wanted.end();
+        if (it != mStats.end() && (*it)->getName() == info.name) {
+            (*it)->setActive(listed);
+            ++it;
+            continue;
+        }
+        if (!listed)
+            continue;
+        std::unique_ptr<StatsType> stats(info.create(context));
+        stats->setBufferSize(info.bufferSize);
+        stats->setName(info.name);
+        {
+            std::unique_lock<std::mutex> mlock(mSubscribersMutex);
+            stats->setStreaming(!mSubscribers.empty());
+        }
+        it = mStats.insert(it, std::move(stats));
+        ++it;
+        LOG_TO(SYSTEM, INFO) << "collector " << info.name << " created";
+    }
+    for (const auto &name : wanted) {
+        if (std::none_of(getCollectorRegistry().begin(), getCollectorRegistry().end(),
+                         [&name](const CollectorInfo &info) { return info.name == name; }))
+            LOG_TO(SYSTEM, WARNING) << "unknown collector " << name << ", ignored";
+    }
 }
 
 void Perfstatsd::refresh(void) {
+    std::unique_lock<std::mutex> mlock(mStatsMutex);
+    // All collectors share one /proc view per tick
+    mProcSnapshot->invalidate();
+    auto now = std::chrono::steady_clock::now();
+    std::chrono::milliseconds slack(mRefreshPeriod * 1000 / 2);
     for (auto const &stats : mStats) {
+        if (!stats->due(now, slack))
+            continue;
+        auto start = std::chrono::steady_clock::now();
         stats->refresh();
+        stats->recordLatency(std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - start));
     }
+    publish();
     return;
 }
 
+void Perfstatsd::subscribe(const sp<SampleSink> &sink, const std::string &collectors) {
+    Subscriber subscriber;
+    subscriber.sink = sink;
+    subscriber.dropped = 0;
+    for (const auto &name : android::base::Split(collectors, ",")) {
+        if (!name.empty())
+            subscriber.collectors.push_back(name);
+    }
+    std::unique_lock<std::mutex> statsLock(mStatsMutex);
+    std::unique_lock<std::mutex> mlock(mSubscribersMutex);
+    mSubscribers.push_back(std::move(subscriber));
+    for (auto const &stats : mStats) {
+        stats->setStreaming(true);
+    }
+    mEvents->setStreaming(true);
+    LOG_TO(SYSTEM, INFO) << "subscribed, collectors: \"" << collectors
+                         << "\", total: " << mSubscribers.size();
+}
+
+void Perfstatsd::unsubscribe(const void *token) {
+    std::unique_lock<std::mutex> statsLock(mStatsMutex);
+    std::unique_lock<std::mutex> mlock(mSubscribersMutex);
+    for (auto it = mSubscribers.begin(); it != mSubscribers.end();) {
+        if (it->sink->token() == token) {
+            it->sink->detach();
+            it = mSubscribers.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    if (mSubscribers.empty()) {
+        for (auto const &stats : mStats) {
+            stats->setStreaming(false);
+        }
+        mEvents->setStreaming(false);
+    }
+    LOG_TO(SYSTEM, INFO) << "unsubscribed, total: " << mSubscribers.size();
+}
+
+// Queue the new samples of |stats| for its subscribers; mSubscribersMutex is held
+void Perfstatsd::collectNewSamples(StatsType *stats) {
+    mNewSamples.clear();
+    stats->takeNewSamples(&mNewSamples);
+    if (mNewSamples.empty()) {
+        return;
+    }
+    for (auto &subscriber : mSubscribers) {
+        if (!subscriber.collectors.empty() &&
+            std::find(subscriber.collectors.begin(), subscriber.collectors.end(),
+                      stats->getName()) == subscriber.collectors.end()) {
+            continue;
+        }
+        for (const auto &data : mNewSamples) {
+            if (subscriber.pending.size() >= SUBSCRIBER_QUEUE_MAX) {
+                subscriber.pending.pop_front();
+                subscriber.dropped++;
+            }
+            subscriber.pending.emplace_back();
+            formatSample(data, &subscriber.pending.back());
+        }
+    }
+}
+
+/*
+ * Push the samples appended in this tick to every subscriber. Each one has a
+ * bounded queue: when a client can't keep up, its oldest samples are dropped
+ * and the count is reported with the next batch it accepts. Called with
+ * mStatsMutex held.
+ */
+void Perfstatsd::publish(void) {
+    std::unique_lock<std::mutex> mlock(mSubscribersMutex);
+    if (mSubscribers.empty()) {
+        return;
+    }
+    for (auto const &stats : mStats) {
+        collectNewSamples(stats.get());
+    }
+    collectNewSamples(mEvents.get());
+    for (auto it = mSubscribers.begin(); it != mSubscribers.end();) {
+        if (it->pending.empty()) {
+            ++it;
+            continue;
+        }
+        std::vector<std::string> batch(it->pending.begin(), it->pending.end());
+        status_t status = it->sink->deliver(batch, it->dropped);
+        if (status == OK) {
+            it->pending.clear();
+            it->dropped = 0;
+        } else if (status == DEAD_OBJECT) {
+            LOG_TO(SYSTEM, WARNING) << "subscriber died, removed";
+            it->sink->detach();
+            it = mSubscribers.erase(it);
+            continue;
+        }
+        ++it;
+    }
+    if (mSubscribers.empty()) {
+        for (auto const &stats : mStats) {
+            stats->setStreaming(false);
+        }
+        mEvents->setStreaming(false);
+    }
+}
+
+void Perfstatsd::getSummary(std::string *ret) {
+    std::unique_lock<std::mutex> mlock(mStatsMutex);
+    for (auto const &stats : mStats) {
+        stats->dumpSummary(ret);
+    }
+}
+
 void Perfstatsd::getHistory(std::string *ret) {
+    getSummary(ret);
     std::priority_queue<StatsData, std::vector<StatsData>, StatsdataCompare> mergedQueue;
-    for (auto const &stats : mStats) {
-        stats->dump(&mergedQueue);
+    {
+        std::unique_lock<std::mutex> mlock(mStatsMutex);
+        for (auto const &stats : mStats) {
+            stats->dump(&mergedQueue);
+        }
+        mEvents->dump(&mergedQueue);
     }
 
     while (!mergedQueue.empty()) {
-        StatsData data = mergedQueue.top();
-        auto raw_time = data.getTime();
-        auto seconds = std::chrono::time_point_cast<std::chrono::seconds>(raw_time);
-        auto d = raw_time - seconds;
-        auto milliseconds = std::chrono::duration_cast<std::chrono::milliseconds>(d);
-        std::string content = data.getData();
-
-        time_t t = std::chrono::system_clock::to_time_t(raw_time);
-        char buff[20];
-        strftime(buff, sizeof(buff), "%m-%d %H:%M:%S", localtime(&t));
-
-        ret->append(std::string(buff) + ".");
-        ret->append(std::to_string(milliseconds.count()) + "\n");
-        ret->append(content + "\n");
+        formatSample(mergedQueue.top(), ret);
         mergedQueue.pop();
     }
 
@@ -68,6 +304,57 @@ void Perfstatsd::getHistory(std::string *ret) {
                                 << *ret;
 }
 
+void Perfstatsd::getHistory(int tier, std::string *ret) {
+    if (tier == ARCHIVE_TIER_RAW) {
+        getHistory(ret);
+        return;
+    }
+    std::unique_lock<std::mutex> mlock(mStatsMutex);
+    for (auto const &stats : mStats) {
+        if (!stats->hasMetrics())
+            continue;
+        ret->append("---- " + stats->getName() + " ----\n");
+        stats->dumpArchive(tier, ret);
+    }
+}
+
+/*
+ * Handle "<collector>.period" and "<collector>.buffer"; other keys belong to
+ * the collectors themselves.
+ */
+bool Perfstatsd::setCollectorOption(const std::string &key, const std::string &value) {
+    size_t dot = key.rfind('.');
+    if (dot == std::string::npos)
+        return false;
+    std::string suffix = key.substr(dot);
+    if (suffix != COLLECTOR_PERIOD_SUFFIX && suffix != COLLECTOR_BUFFER_SUFFIX)
+        return false;
+    StatsType *stats = findStats(key.substr(0, dot));
+    if (stats == nullptr)
+        return false;
+    uint32_t val = 0;
+    if (!base::ParseUint(value, &val)) {
+        LOG_TO(SYSTEM, ERROR) << "Invalid value: " << value;
+        return true;
+    }
+    if (suffix == COLLECTOR_PERIOD_SUFFIX) {
+        stats->setPeriod(val);
+        LOG_TO(SYSTEM, INFO) << "set " << stats->getName() << " period to " << val << " seconds";
+    } else {
+        stats->setBufferSize(val);
+        LOG_TO(SYSTEM, INFO) << "set " << stats->getName() << " buffer to " << val << " samples";
+    }
+    return true;
+}
+
+/*
+ * setOptions - Perfstatsd supports following options, besides the ones of
+ * each collector
+ *     perfstatsd.period : seconds between ticks
+ *     perfstatsd.collectors : comma separated collectors to refresh (default: all)
+ *     <collector>.period : seconds between refreshes of the collector; 0 - every tick
+ *     <collector>.buffer : samples kept by the collector
+ */
 void Perfstatsd::setOptions(const std::string &key, const std::string &value) {
     if (key == PERFSTATSD_PERIOD) {
         uint32_t val = 0;
@@ -80,6 +367,14 @@ void Perfstatsd::setOptions(const std::string &key, const std::string &value) {
         return;
     }
 
+    std::unique_lock<std::mutex> mlock(mStatsMutex);
+    if (key == PERFSTATSD_COLLECTORS) {
+        setCollectors(value);
+        LOG_TO(SYSTEM, INFO) << "set collectors to \"" << value << "\"";
+        return;
+    }
+    if (setCollectorOption(key, value))
+        return;
     for (auto const &stats : mStats) {
         stats->setOptions(std::forward<const std::string>(key),
                           std::forward<const std::string>(value));
@@ -19,6 +19,36 @@
 #include <perfstatsd.h>
 #include <perfstatsd_service.h>
 
+// Forwards streamed samples to a client callback and drops it when it dies;
+// the death link lives until the subscriber is removed
+class CallbackSink : public SampleSink, public android::IBinder::DeathRecipient {
+  public:
+    CallbackSink(const android::sp<IPerfstatsdCallback> &callback) : mCallback(callback) {}
+
+    android::status_t deliver(const std::vector<std::string> &samples, uint32_t dropped) override {
+        android::binder::Status status = mCallback->onSamples(samples, dropped);
+        if (status.isOk())
+            return android::OK;
+        if (status.exceptionCode() == android::binder::Status::EX_TRANSACTION_FAILED)
+            return status.transactionError();
+        return android::UNKNOWN_ERROR;
+    }
+
+    const void *token() const override {
+        return android::IInterface::asBinder(mCallback).get();
+    }
+
+    void detach() override { android::IInterface::asBinder(mCallback)->unlinkToDeath(this); }
+
+    void binderDied(const android::wp<android::IBinder> &who) override {
+        if (perfstatsdSp != nullptr)
+            perfstatsdSp->unsubscribe(who.unsafe_get());
+    }
+
+  private:
+    android::sp<IPerfstatsdCallback> mCallback;
+};
+
 android::status_t PerfstatsdPrivateService::start() {
     return BinderService<PerfstatsdPrivateService>::publish();
 }
@@ -28,6 +58,20 @@ android::binder::Status PerfstatsdPrivateService::dumpHistory(std::string *_aidl
     return android::binder::Status::ok();
 }
 
+android::binder::Status PerfstatsdPrivateService::dumpHistoryTier(int32_t tier,
+                                                                  std::string *_aidl_return) {
+    if (tier < ARCHIVE_TIER_RAW || tier >= ARCHIVE_TIER_MAX)
+        return android::binder::Status::fromExceptionCode(
+            android::binder::Status::EX_ILLEGAL_ARGUMENT);
+    perfstatsdSp->getHistory(tier, _aidl_return);
+    return android::binder::Status::ok();
+}
+
+android::binder::Status PerfstatsdPrivateService::dumpSummary(std::string *_aidl_return) {
+    perfstatsdSp->getSummary(_aidl_return);
+    return android::binder::Status::ok();
+}
+
 android::binder::Status PerfstatsdPrivateService::setOptions(const std::string &key,
                                                              const std::string &value) {
     perfstatsdSp->setOptions(std::forward<const std::string>(key),
@@ -35,6 +79,30 @@ android::binder::Status PerfstatsdPrivateService::setOptions(const std::string &
     return android::binder::Status::ok();
 }
 
+android::binder::Status PerfstatsdPrivateService::registerCallback(
+    const android::sp<IPerfstatsdCallback> &callback, const std::string &collectors) {
+    if (callback == nullptr)
+        return android::binder::Status::fromExceptionCode(
+            android::binder::Status::EX_NULL_POINTER);
+    if (perfstatsdSp == nullptr)
+        return android::binder::Status::fromExceptionCode(
+            android::binder::Status::EX_ILLEGAL_STATE);
+
+    android::sp<CallbackSink> sink = new CallbackSink(callback);
+    android::status_t ret = android::IInterface::asBinder(callback)->linkToDeath(sink);
+    if (ret != android::OK)
+        return android::binder::Status::fromStatusT(ret);
+    perfstatsdSp->subscribe(sink, collectors);
+    return android::binder::Status::ok();
+}
+
+android::binder::Status PerfstatsdPrivateService::unregisterCallback(
+    const android::sp<IPerfstatsdCallback> &callback) {
+    if (callback != nullptr && perfstatsdSp != nullptr)
+        perfstatsdSp->unsubscribe(android::IInterface::asBinder(callback).get());
+    return android::binder::Status::ok();
+}
+
 android::sp<IPerfstatsdPrivate> getPerfstatsdPrivateService() {
     android::sp<android::IServiceManager> sm = android::defaultServiceManager();
     if (sm == NULL)
@@ -0,0 +1,259 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "perfstatsd_proc"
+
+#include "proc_snapshot.h"
+#include <fcntl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <algorithm>
+#include "text_parser.h"
+
+using namespace android::pixel::perfstatsd;
+
+enum ProcField : uint32_t {
+    PROC_FIELD_STAT = 1 << 0,
+    PROC_FIELD_STATUS = 1 << 1,
+    PROC_FIELD_IDENTITY = 1 << 2,
+};
+
+// layout returned by getdents64(2)
+struct linux_dirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+ProcSnapshot::ProcSnapshot(void) : mScanned(false), mDents(PROC_DENTS_BUFFER_SIZE) {}
+
+void ProcSnapshot::invalidate(void) {
+    mScanned = false;
+}
+
+void ProcSnapshot::scan(void) {
+    mScanned = true;
+    mPids.clear();
+    int fd = open("/proc", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        LOG_TO(SYSTEM, ERROR) << "Fail to open /proc/";
+        mEntries.clear();
+        return;
+    }
+    long nread;
+    while ((nread = syscall(SYS_getdents64, fd, mDents.data(), mDents.size())) > 0) {
+        for (long pos = 0; pos < nread;) {
+            auto *ent = reinterpret_cast<linux_dirent64 *>(mDents.data() + pos);
+            pos += ent->d_reclen;
+            if (ent->d_type != DT_DIR) {
+                continue;
+            }
+            uint32_t pid = 0;
+            const char *c = ent->d_name;
+            for (; *c >= '0' && *c <= '9'; c++) {
+                pid = pid * 10 + (*c - '0');
+            }
+            if (c != ent->d_name && *c == '\0') {
+                mPids.push_back(pid);
+            }
+        }
+    }
+    if (nread < 0) {
+        PLOG_TO(SYSTEM, ERROR) << "getdents64 failed on /proc/";
+    }
+    close(fd);
+
+    if (!std::is_sorted(mPids.begin(), mPids.end())) {
+        std::sort(mPids.begin(), mPids.end());
+    }
+    // Keep the per-pid strings around so their capacity is reused next tick.
+    mEntries.resize(mPids.size());
+    for (size_t i = 0; i < mPids.size(); i++) {
+        mEntries[i].pid = mPids[i];
+        mEntries[i].cached = 0;
+        mEntries[i].identity = nullptr;
+    }
+    for (auto it = mIdentities.begin(); it != mIdentities.end();) {
+        if (!std::binary_search(mPids.begin(), mPids.end(), it->first))
+            it = mIdentities.erase(it);
+        else
+            ++it;
+    }
+}
+
+const std::vector<uint32_t> &ProcSnapshot::getPids(void) {
+    if (!mScanned) {
+        scan();
+    }
+    return mPids;
+}
+
+ProcEntry *ProcSnapshot::findEntry(uint32_t pid) {
+    getPids();
+    auto it = std::lower_bound(mPids.begin(), mPids.end(), pid);
+    if (it == mPids.end() || *it != pid) {
+        return nullptr;
+    }
+    return &mEntries[it - mPids.begin()];
+}
+
+const std::string *ProcSnapshot::readField(uint32_t pid, uint32_t field) {
+    ProcEntry *entry = findEntry(pid);
+    if (entry == nullptr) {
+        return nullptr;
+    }
+    std::string *content = (field == PROC_FIELD_STAT) ? &entry->stat : &entry->status;
+    if (!(entry->cached & field)) {
+        char path[32];
+        snprintf(path, sizeof(path), "/proc/%u/%s", pid,
+                 (field == PROC_FIELD_STAT) ? "stat" : "status");
+        if (!android::base::ReadFileToString(path, content)) {
+            content->clear();
+        }
+        entry->cached |= field;
+    }
+    // An empty read means the process exited after the directory walk.
+    return content->empty() ? nullptr : content;
+}
+
+const std::string *ProcSnapshot::getStat(uint32_t pid) {
+    return readField(pid, PROC_FIELD_STAT);
+}
+
+const std::string *ProcSnapshot::getStatus(uint32_t pid) {
+    return readField(pid, PROC_FIELD_STATUS);
+}
+
+// starttime is field 22 of /proc/<pid>/stat, counted after the comm that may hold spaces
+static bool parseStartTime(const std::string &stat, uint64_t *starttime) {
+    size_t close = stat.rfind(')');
+    if (close == std::string::npos) {
+        return false;
+    }
+    TextScanner scanner(std::string_view(stat).substr(close + 1));
+    // fields 3 (state) .. 21 (itrealvalue)
+    for (int i = 3; i < 22; i++) {
+        if (!scanner.skipToken()) {
+            return false;
+        }
+    }
+    return scanner.parseUint(starttime);
+}
+
+/*
+ * Parse /proc/<pid>/cgroup, e.g.
+ *   4:cpuset:/top-app
+ *   0::/uid_10061/pid_5720
+ * The cpuset group tells foreground from background; the cgroup v2 path is
+ * used when there is no cpuset hierarchy.
+ */
+static void parseCgroup(std::string_view text, std::string *cgroup) {
+    cgroup->clear();
+    TextScanner scanner(text);
+    for (; !scanner.atEnd(); scanner.nextLine()) {
+        std::string_view line = scanner.restOfLine();
+        size_t first = line.find(':');
+        size_t second = line.find(':', first + 1);
+        if (first == std::string_view::npos || second == std::string_view::npos) {
+            continue;
+        }
+        std::string_view controllers = line.substr(first + 1, second - first - 1);
+        std::string_view path = line.substr(second + 1);
+        if (!path.empty() && path[0] == '/') {
+            path.remove_prefix(1);
+        }
+        if (controllers == "cpuset") {
+            cgroup->assign(path);
+            return;
+        }
+        if (controllers.empty()) {
+            cgroup->assign(path);
+        }
+    }
+}
+
+bool ProcSnapshot::fillIdentity(const std::string &stat, ProcIdentity *identity) {
+    size_t commStart = stat.find('(');
+    size_t commEnd = stat.rfind(')');
+    const std::string *status = getStatus(identity->pid);
+    if (commStart == std::string::npos || commEnd == std::string::npos || commEnd < commStart ||
+        status == nullptr) {
+        return false;
+    }
+    identity->comm.assign(stat, commStart + 1, commEnd - commStart - 1);
+    size_t uid = status->find("\nUid:");
+    if (uid == std::string::npos ||
+        !TextScanner(std::string_view(*status).substr(uid + strlen("\nUid:")))
+                 .parseUint(&identity->uid)) {
+        return false;
+    }
+
+    char path[32];
+    snprintf(path, sizeof(path), "/proc/%u/cmdline", identity->pid);
+    identity->cmdline.clear();
+    int fd = TEMP_FAILURE_RETRY(open(path, O_RDONLY | O_CLOEXEC));
+    if (fd >= 0) {
+        char cmdline[PROC_CMDLINE_MAX];
+        ssize_t len = TEMP_FAILURE_RETRY(read(fd, cmdline, sizeof(cmdline)));
+        close(fd);
+        // Arguments are NUL separated; kernel threads have none
+        for (; len > 0 && cmdline[len - 1] == '\0'; len--) {
+        }
+        if (len > 0) {
+            std::replace(cmdline, cmdline + len, '\0', ' ');
+            identity->cmdline.assign(cmdline, len);
+        }
+    }
+
+    snprintf(path, sizeof(path), "/proc/%u/cgroup", identity->pid);
+    if (readFileToBuffer(path, &mBuffer)) {
+        parseCgroup(mBuffer, &identity->cgroup);
+    } else {
+        identity->cgroup.clear();
+    }
+    return true;
+}
+
+const ProcIdentity *ProcSnapshot::getIdentity(uint32_t pid) {
+    ProcEntry *entry = findEntry(pid);
+    if (entry == nullptr) {
+        return nullptr;
+    }
+    if (!(entry->cached & PROC_FIELD_IDENTITY)) {
+        entry->cached |= PROC_FIELD_IDENTITY;
+        const std::string *stat = getStat(pid);
+        uint64_t starttime;
+        if (stat == nullptr || !parseStartTime(*stat, &starttime)) {
+            return nullptr;
+        }
+        auto it = mIdentities.find(pid);
+        if (it == mIdentities.end() || it->second.starttime != starttime) {
+            // New process, or a new one behind a reused pid
+            ProcIdentity &identity = mIdentities[pid];
+            identity.pid = pid;
+            identity.starttime = starttime;
+            if (!fillIdentity(*stat, &identity)) {
+                mIdentities.erase(pid);
+                return nullptr;
+            }
+            it = mIdentities.find(pid);
+        }
+        entry->identity = &it->second;
+    }
+    return entry->identity;
+}
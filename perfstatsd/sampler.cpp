@@ -0,0 +1,73 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "perfstatsd"
+
+#include "sampler.h"
+#include <android-base/logging.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+
+using namespace android::pixel::perfstatsd;
+
+static std::chrono::nanoseconds readClock(clockid_t clock) {
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return std::chrono::seconds(ts.tv_sec) + std::chrono::nanoseconds(ts.tv_nsec);
+}
+
+Sampler::Sampler(void) : mArmedPeriod(0), mSuspended(0) {
+    mTimerFd.reset(timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC));
+    if (mTimerFd < 0)
+        PLOG_TO(SYSTEM, ERROR) << "timerfd_create failed, falling back to sleep";
+    mLastBoottime = readClock(CLOCK_BOOTTIME);
+    mLastMonotonic = readClock(CLOCK_MONOTONIC);
+}
+
+bool Sampler::arm(uint32_t period) {
+    struct itimerspec spec = {};
+    spec.it_interval.tv_sec = period;
+    spec.it_value.tv_sec = period;
+    if (timerfd_settime(mTimerFd, 0, &spec, NULL) != 0) {
+        PLOG_TO(SYSTEM, ERROR) << "timerfd_settime failed";
+        return false;
+    }
+    mArmedPeriod = period;
+    return true;
+}
+
+void Sampler::wait(uint32_t period) {
+    bool waited = false;
+    if (mTimerFd >= 0 && (mArmedPeriod == period || arm(period))) {
+        uint64_t expirations;
+        waited = TEMP_FAILURE_RETRY(read(mTimerFd, &expirations, sizeof(expirations))) ==
+                 sizeof(expirations);
+    }
+    if (!waited) {
+        // nanosleep also runs on CLOCK_MONOTONIC
+        sleep(period);
+    }
+
+    std::chrono::nanoseconds boottime = readClock(CLOCK_BOOTTIME);
+    std::chrono::nanoseconds monotonic = readClock(CLOCK_MONOTONIC);
+    mSuspended = std::chrono::duration_cast<std::chrono::milliseconds>(
+        (boottime - mLastBoottime) - (monotonic - mLastMonotonic));
+    if (mSuspended.count() < SUSPEND_MIN_MS)
+        mSuspended = std::chrono::milliseconds(0);
+    mLastBoottime = boottime;
+    mLastMonotonic = monotonic;
+}
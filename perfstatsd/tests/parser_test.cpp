@@ -0,0 +1,307 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <android-base/file.h>
+#include <gtest/gtest.h>
+#include <unistd.h>
+
+#include "binder_stats.h"
+#include "cpu_throttle.h"
+#include "devfreq_stats.h"
+#include "f2fs_stats.h"
+#include "io_usage.h"
+#include "net_stats.h"
+#include "text_parser.h"
+#include "wakeup_stats.h"
+
+namespace android {
+namespace pixel {
+namespace perfstatsd {
+
+TEST(TextScannerTest, TokensAndNumbers) {
+    TextScanner scanner("  cpu0 558\t139 x\nnext");
+    std::string_view token;
+    uint64_t a, b;
+    ASSERT_TRUE(scanner.token(&token));
+    EXPECT_EQ("cpu0", token);
+    ASSERT_TRUE(scanner.parseUint(&a));
+    ASSERT_TRUE(scanner.parseUint(&b));
+    EXPECT_EQ(558u, a);
+    EXPECT_EQ(139u, b);
+    EXPECT_FALSE(scanner.parseUint(&a));
+    EXPECT_EQ("x", scanner.restOfLine());
+    EXPECT_TRUE(scanner.skipToken());
+    EXPECT_TRUE(scanner.atEol());
+    EXPECT_FALSE(scanner.skipToken());
+    scanner.nextLine();
+    EXPECT_TRUE(scanner.consume("ne"));
+    EXPECT_FALSE(scanner.consume("xy"));
+    EXPECT_TRUE(scanner.consume("xt"));
+    EXPECT_TRUE(scanner.atEnd());
+}
+
+TEST(TextScannerTest, StopsAtEndOfLine) {
+    TextScanner scanner("requested threads: 0+10/31\nready threads 3\n");
+    uint32_t value;
+    ASSERT_TRUE(scanner.consume("requested threads:"));
+    EXPECT_TRUE(scanner.skipPast('+'));
+    EXPECT_TRUE(scanner.parseUint(&value));
+    EXPECT_EQ(10u, value);
+    // '+' only appears on the line already passed
+    EXPECT_FALSE(scanner.skipPast('+'));
+    EXPECT_TRUE(scanner.atEol());
+    scanner.nextLine();
+    EXPECT_TRUE(scanner.consume("ready threads"));
+}
+
+TEST(TextScannerTest, EmptyAndTruncatedInput) {
+    TextScanner empty("");
+    uint64_t value;
+    std::string_view token;
+    EXPECT_TRUE(empty.atEnd());
+    EXPECT_TRUE(empty.atEol());
+    EXPECT_FALSE(empty.parseUint(&value));
+    EXPECT_FALSE(empty.token(&token));
+    EXPECT_FALSE(empty.consume("x"));
+    empty.nextLine();
+    EXPECT_TRUE(empty.atEnd());
+
+    // A prefix longer than the remaining input must not read past it
+    TextScanner truncated("BC_TRANS");
+    EXPECT_FALSE(truncated.consume("BC_TRANSACTION:"));
+    EXPECT_TRUE(truncated.consume("BC_TRANS"));
+    EXPECT_TRUE(truncated.atEnd());
+
+    // Values that overflow the destination are rejected
+    TextScanner overflow("4294967296");
+    uint32_t small;
+    EXPECT_FALSE(overflow.parseUint(&small));
+}
+
+TEST(ParserTest, UidIoStats) {
+    std::vector<UserIo> rows;
+    parseUidIoStats(
+        "10061 1 2 3 4 5 6 7 8 9 10\n"
+        "1000 0 0 100 200 0 0 300 400 5 6\n"
+        "\n"
+        "10062 1 2 3\n"  // short line
+        "10063 1 2 3 4 5 6 7 8 9",  // truncated, no fsync column
+        &rows);
+    ASSERT_EQ(2u, rows.size());
+    EXPECT_EQ(10061u, rows[0].uid);
+    EXPECT_EQ(3u, rows[0].fgRead);
+    EXPECT_EQ(4u, rows[0].fgWrite);
+    EXPECT_EQ(7u, rows[0].bgRead);
+    EXPECT_EQ(8u, rows[0].bgWrite);
+    EXPECT_EQ(9u, rows[0].fgFsync);
+    EXPECT_EQ(10u, rows[0].bgFsync);
+    EXPECT_EQ(1000u, rows[1].uid);
+    EXPECT_EQ(400u, rows[1].bgWrite);
+
+    parseUidIoStats("", &rows);
+    EXPECT_TRUE(rows.empty());
+}
+
+TEST(ParserTest, BinderStats) {
+    std::vector<BinderProc> procs;
+    BinderStats::parseStats(
+        "binder stats:\n"
+        "BC_TRANSACTION: 99999\n"  // global, before any proc
+        "proc 200\n"
+        "context binder\n"
+        "  threads: 4\n"
+        "  requested threads: 0+2/2\n"
+        "  ready threads 0\n"
+        "  pending transactions: 3\n"
+        "  BC_TRANSACTION: 10\n"
+        "  BC_TRANSACTION_SG: 5\n"
+        "  BR_TRANSACTION: 7\n"
+        "proc 100\n"
+        "context binder\n"
+        "  requested threads: 0+1/15\n"
+        "  ready threads 2\n"
+        "  BR_TRANSACTION_SEC_CTX: 4\n"
+        "  BR_SPAWN_LOOPER: 1\n"
+        "proc 200\n"
+        "context hwbinder\n"
+        "  BC_TRANSACTION: 1\n"
+        "  BR_TRANSACTION:\n"  // truncated value
+        "proc\n",              // truncated pid
+        &procs);
+    ASSERT_EQ(2u, procs.size());
+    EXPECT_EQ(100u, procs[0].pid);
+    EXPECT_EQ(4u, procs[0].incoming);
+    EXPECT_EQ(1u, procs[0].spawned);
+    EXPECT_EQ(2u, procs[0].ready);
+    EXPECT_FALSE(procs[0].exhausted);
+    // Both contexts of pid 200 are folded together
+    EXPECT_EQ(200u, procs[1].pid);
+    EXPECT_EQ(16u, procs[1].outgoing);
+    EXPECT_EQ(7u, procs[1].incoming);
+    EXPECT_EQ(3u, procs[1].pending);
+    EXPECT_TRUE(procs[1].exhausted);
+}
+
+TEST(ParserTest, DevfreqTransStat) {
+    DevfreqDevice dev;
+    dev.valid = true;
+    ASSERT_TRUE(DevfreqStats::parseTransStat(
+        "     From  :   To\n"
+        "           : 421000000 546000000 676000000   time(ms)\n"
+        "* 421000000:         0        12         3     81320\n"
+        "  546000000:        10         0         4     10240\n"
+        "  676000000:         5         2         0      2210\n"
+        "Total transition : 36\n",
+        &dev));
+    EXPECT_EQ((std::vector<uint64_t>{421000000, 546000000, 676000000}), dev.freqs);
+    EXPECT_EQ((std::vector<uint64_t>{81320, 10240, 2210}), dev.currMs);
+    // A new table can't be diffed against the last one
+    EXPECT_FALSE(dev.valid);
+
+    dev.valid = true;
+    ASSERT_TRUE(DevfreqStats::parseTransStat(
+        "* 421000000:         0        12         3     81400\n"
+        "  546000000:        10         0         4     10240\n"
+        "  676000000:         5         2         0      2300\n",
+        &dev));
+    EXPECT_EQ((std::vector<uint64_t>{81400, 10240, 2300}), dev.currMs);
+    EXPECT_TRUE(dev.valid);
+
+    // A short read drops rows, which also resets the table
+    ASSERT_TRUE(DevfreqStats::parseTransStat("* 421000000:         0        12", &dev));
+    EXPECT_EQ(1u, dev.freqs.size());
+    EXPECT_FALSE(dev.valid);
+
+    EXPECT_FALSE(DevfreqStats::parseTransStat("     From  :   To\n", &dev));
+}
+
+TEST(ParserTest, NetDev) {
+    std::vector<NetIface> ifaces;
+    NetStats::parseNetDev(
+        "Inter-|   Receive                            |  Transmit\n"
+        " face |bytes    packets errs drop fifo frame compressed multicast|bytes    packets "
+        "errs drop fifo colls carrier compressed\n"
+        " wlan0: 81236912   70211    0    4    0     0          0         0 9120331   51092    "
+        "0    1    0     0       0          0\n"
+        "    lo:1000 10 0 0 0 0 0 0 1000 10 0 0 0 0 0 0\n"
+        " rmnet0: 5 1 0\n",  // short line
+        &ifaces);
+    ASSERT_EQ(2u, ifaces.size());
+    // Sorted by name
+    EXPECT_STREQ("lo", ifaces[0].name);
+    EXPECT_EQ(1000u, ifaces[0].rxBytes);
+    EXPECT_STREQ("wlan0", ifaces[1].name);
+    EXPECT_EQ(81236912u, ifaces[1].rxBytes);
+    EXPECT_EQ(70211u, ifaces[1].rxPackets);
+    EXPECT_EQ(4u, ifaces[1].rxDrops);
+    EXPECT_EQ(9120331u, ifaces[1].txBytes);
+    EXPECT_EQ(51092u, ifaces[1].txPackets);
+    EXPECT_EQ(1u, ifaces[1].txDrops);
+}
+
+TEST(ParserTest, WakeupDebugfs) {
+    std::map<std::string, WakeupSource, std::less<>> sources;
+    WakeupStats::parseDebugfs(
+        "name\t\tactive_count\tevent_count\twakeup_count\texpire_count\tactive_since\t"
+        "total_time\tmax_time\tlast_change\tprevent_suspend_time\n"
+        "PowerManager.SuspendLockout\t0\t0\t0\t0\t0\t0\t0\t29871\t0\n"
+        "qcom_rx_wakelock\t12\t40\t3\t0\t150\t520\t90\t29000\t0\n"
+        "truncated\t1\t2\n",
+        &sources);
+    ASSERT_EQ(2u, sources.size());
+    const WakeupSource &rx = sources.at("qcom_rx_wakelock");
+    EXPECT_EQ(40u, rx.curr[WAKEUP_EVENT_COUNT]);
+    EXPECT_EQ(520u, rx.curr[WAKEUP_TOTAL_TIME]);
+    EXPECT_FALSE(rx.valid);
+
+    // Sources gone from the table are dropped
+    WakeupStats::parseDebugfs("name\nqcom_rx_wakelock\t12\t41\t3\t0\t0\t600\t90\t29100\t0\n",
+                              &sources);
+    ASSERT_EQ(1u, sources.size());
+    EXPECT_EQ(600u, sources.at("qcom_rx_wakelock").curr[WAKEUP_TOTAL_TIME]);
+}
+
+TEST(ParserTest, F2fsStatus) {
+    static constexpr char STATUS[] =
+        "=====[ partition info(dm-5). #0, RW, CP: Good]=====\n"
+        "  - Dirty: 100\n"
+        "=====[ partition info(sda34). #1, RW, CP: Good]=====\n"
+        "[SSA: 448] [MAIN: 60928(OverProv:1732 Resv:1164)]\n"
+        "  - Dirty: 1291\n"
+        "  - Free: 50235 (50235)\n"
+        "  CP calls: 10516 (BG: 8833)\n"
+        "  CP merge (Queued:    0, Issued:    0, Total:    0, Cur time:    0(ms), Peak time:   "
+        "42(ms))\n"
+        "  GC calls: 86 (BG: 80)\n";
+    uint64_t counters[F2FS_COUNTER_MAX];
+    uint64_t cpPeakMs = F2FS_NO_VALUE;
+    std::fill(counters, counters + F2FS_COUNTER_MAX, F2FS_NO_VALUE);
+    counters[F2FS_FREE_SEGS] = 7;  // already read from sysfs
+    ASSERT_TRUE(F2fsStats::parseStatus(STATUS, "sda34", counters, &cpPeakMs));
+    EXPECT_EQ(1291u, counters[F2FS_DIRTY_SEGS]);
+    EXPECT_EQ(7u, counters[F2FS_FREE_SEGS]);
+    EXPECT_EQ(1683u, counters[F2FS_CP_FG]);
+    EXPECT_EQ(8833u, counters[F2FS_CP_BG]);
+    EXPECT_EQ(6u, counters[F2FS_GC_FG]);
+    EXPECT_EQ(80u, counters[F2FS_GC_BG]);
+    EXPECT_EQ(42u, cpPeakMs);
+
+    // The section of another partition is not read
+    std::fill(counters, counters + F2FS_COUNTER_MAX, F2FS_NO_VALUE);
+    ASSERT_TRUE(F2fsStats::parseStatus(STATUS, "dm-5", counters, &cpPeakMs));
+    EXPECT_EQ(100u, counters[F2FS_DIRTY_SEGS]);
+    EXPECT_EQ(F2FS_NO_VALUE, counters[F2FS_GC_FG]);
+
+    EXPECT_FALSE(F2fsStats::parseStatus(STATUS, "sda35", counters, &cpPeakMs));
+    // Truncated in the middle of a line
+    std::fill(counters, counters + F2FS_COUNTER_MAX, F2FS_NO_VALUE);
+    ASSERT_TRUE(F2fsStats::parseStatus(
+        "=====[ partition info(sda34). #1]=====\n  CP calls: 10516 (BG:", "sda34", counters,
+        &cpPeakMs));
+    EXPECT_EQ(F2FS_NO_VALUE, counters[F2FS_CP_FG]);
+}
+
+TEST(ParserTest, CoolingTimeInState) {
+    CpuPolicy policy;
+    ASSERT_TRUE(CpuThrottle::parseStates("state0 812345\nstate1 1200\nstate2 0\n", &policy));
+    EXPECT_EQ((std::vector<uint64_t>{812345, 1200, 0}), policy.currStateMs);
+
+    // Missing and malformed rows read as zero
+    ASSERT_TRUE(CpuThrottle::parseStates("state0 900000\nstate2\nstate", &policy));
+    EXPECT_EQ((std::vector<uint64_t>{900000, 0, 0}), policy.currStateMs);
+
+    CpuPolicy empty;
+    EXPECT_FALSE(CpuThrottle::parseStates("", &empty));
+}
+
+TEST(ReadBufferTest, ReusesBuffer) {
+    TemporaryFile file;
+    std::string content(10000, 'x');
+    ASSERT_TRUE(android::base::WriteStringToFile(content, file.path));
+    std::string buf;
+    ASSERT_TRUE(readFileToBuffer(file.path, &buf));
+    EXPECT_EQ(content, buf);
+    ASSERT_TRUE(android::base::WriteStringToFile("12\n", file.path));
+    ASSERT_TRUE(readFileToBuffer(file.path, &buf));
+    EXPECT_EQ("12\n", buf);
+    EXPECT_GE(buf.capacity(), content.size());
+    EXPECT_FALSE(readFileToBuffer("/nonexistent", &buf));
+    EXPECT_TRUE(buf.empty());
+}
+
+}  // namespace perfstatsd
+}  // namespace pixel
+}  // namespace android
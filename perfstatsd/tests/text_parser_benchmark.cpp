@@ -0,0 +1,87 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <android-base/parseint.h>
+#include <android-base/stringprintf.h>
+#include <android-base/strings.h>
+#include <benchmark/benchmark.h>
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "io_usage.h"
+#include "text_parser.h"
+
+using namespace android::pixel::perfstatsd;
+
+// /proc/uid_io/stats with |rows| uids, like a device with that many apps
+static std::string makeUidIoStats(int rows) {
+    std::string text;
+    for (int i = 0; i < rows; i++) {
+        text += android::base::StringPrintf("%d 123456789 98765432 4096000 8192000 1234 5678 "
+                                            "40960 81920 %d %d\n",
+                                            10000 + i, i, i * 2);
+    }
+    return text;
+}
+
+// The parser IoUsage used before TextScanner: split into lines, then fields
+static void parseWithSplit(std::string buffer, std::unordered_map<uint32_t, UserIo> *out) {
+    out->clear();
+    std::vector<std::string> lines = android::base::Split(std::move(buffer), "\n");
+    for (const auto &line : lines) {
+        if (line.empty()) {
+            continue;
+        }
+        std::vector<std::string> fields = android::base::Split(line, " ");
+        UserIo data;
+        if (fields.size() < 11 || !android::base::ParseUint(fields[0], &data.uid) ||
+            !android::base::ParseUint(fields[3], &data.fgRead) ||
+            !android::base::ParseUint(fields[4], &data.fgWrite) ||
+            !android::base::ParseUint(fields[7], &data.bgRead) ||
+            !android::base::ParseUint(fields[8], &data.bgWrite) ||
+            !android::base::ParseUint(fields[9], &data.fgFsync) ||
+            !android::base::ParseUint(fields[10], &data.bgFsync)) {
+            continue;
+        }
+        (*out)[data.uid] = data;
+    }
+}
+
+static void BM_UidIoSplit(benchmark::State &state) {
+    const std::string text = makeUidIoStats(state.range(0));
+    std::unordered_map<uint32_t, UserIo> rows;
+    for (auto _ : state) {
+        parseWithSplit(text, &rows);
+        benchmark::DoNotOptimize(rows);
+    }
+    state.SetBytesProcessed(state.iterations() * text.size());
+}
+BENCHMARK(BM_UidIoSplit)->Arg(100)->Arg(500)->Arg(2000);
+
+static void BM_UidIoTextScanner(benchmark::State &state) {
+    const std::string text = makeUidIoStats(state.range(0));
+    std::vector<UserIo> rows;
+    for (auto _ : state) {
+        parseUidIoStats(text, &rows);
+        benchmark::DoNotOptimize(rows);
+    }
+    state.SetBytesProcessed(state.iterations() * text.size());
+}
+BENCHMARK(BM_UidIoTextScanner)->Arg(100)->Arg(500)->Arg(2000);
+
+BENCHMARK_MAIN();
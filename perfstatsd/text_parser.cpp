@@ -0,0 +1,61 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "text_parser.h"
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace android {
+namespace pixel {
+namespace perfstatsd {
+
+static constexpr size_t READ_CHUNK_SIZE = 4096;
+
+bool readFdToBuffer(int fd, std::string *buf) {
+    // resize() never shrinks capacity, so steady-state reads stay in place
+    size_t len = 0;
+    while (true) {
+        if (buf->size() < len + READ_CHUNK_SIZE) {
+            buf->resize(len + READ_CHUNK_SIZE);
+        }
+        ssize_t n = TEMP_FAILURE_RETRY(pread(fd, &(*buf)[len], buf->size() - len, len));
+        if (n < 0) {
+            buf->clear();
+            return false;
+        }
+        if (n == 0) {
+            break;
+        }
+        len += n;
+    }
+    buf->resize(len);
+    return true;
+}
+
+bool readFileToBuffer(const char *path, std::string *buf) {
+    int fd = TEMP_FAILURE_RETRY(open(path, O_RDONLY | O_CLOEXEC));
+    if (fd < 0) {
+        buf->clear();
+        return false;
+    }
+    bool ret = readFdToBuffer(fd, buf);
+    close(fd);
+    return ret;
+}
+
+}  // namespace perfstatsd
+}  // namespace pixel
+}  // namespace android
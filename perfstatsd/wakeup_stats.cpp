@@ -0,0 +1,294 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "perfstatsd_wakeup"
+
+#include "wakeup_stats.h"
+#include <android-base/stringprintf.h>
+#include <android-base/strings.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <algorithm>
+#include "text_parser.h"
+
+using namespace android::pixel::perfstatsd;
+
+static constexpr const char *WAKEUP_CLASS_DIR = "/sys/class/wakeup/";
+static constexpr const char *WAKEUP_DEBUGFS_PATH = "/sys/kernel/debug/wakeup_sources";
+static constexpr const char *SUSPEND_STATS_DIR = "/sys/power/suspend_stats/";
+static constexpr const char *SUSPEND_DEBUGFS_PATH = "/sys/kernel/debug/suspend_stats";
+// Indexed by WakeupCounter
+static constexpr const char *WAKEUP_NODES[WAKEUP_COUNTER_MAX] = {
+    "total_time_ms",
+    "event_count",
+};
+// Indexed by SuspendCounter
+static constexpr const char *SUSPEND_NODES[SUSPEND_COUNTER_MAX] = {
+    "success",
+    "fail",
+};
+
+static constexpr char FMT_WAKEUP[] = "[WAKEUP: %lld.%03llds] suspend success:%" PRIu64
+                                     " fail:%" PRIu64 " sources:%zu\n";
+static constexpr char FMT_WAKEUP_TOP[] =
+    "[WAKEUP_TOP%zu] %s held:%" PRIu64 ".%03" PRIu64 "s events:%" PRIu64 "\n";
+
+static bool cDebug = false;
+
+WakeupStats::WakeupStats(void)
+    : mDisabled(false), mTopCount(WAKEUP_TOP_DEFAULT), mTicks(0), mSuspendValid(false) {
+    mLast = std::chrono::steady_clock::now();
+    mUseSysfs = access(WAKEUP_CLASS_DIR, R_OK) == 0;
+    if (mUseSysfs) {
+        scanSources();
+    }
+    for (int i = 0; i < SUSPEND_COUNTER_MAX; i++) {
+        std::string path = std::string(SUSPEND_STATS_DIR) + SUSPEND_NODES[i];
+        mSuspendFds[i].reset(TEMP_FAILURE_RETRY(open(path.c_str(), O_RDONLY | O_CLOEXEC)));
+    }
+}
+
+/*
+ * setOptions - WakeupStats supports following options
+ *     wakeupstats.topcount : number of wakeup sources listed, by time held
+ *     wakeupstats.disabled : 1 - to stop collecting; 0 - enabled
+ *     wakeupstats.debug : 1 - to enable debug log; 0 - disabled
+ */
+void WakeupStats::setOptions(const std::string &key, const std::string &value) {
+    if (key == WAKEUPSTATS_TOPCOUNT || key == WAKEUPSTATS_DISABLED || key == WAKEUPSTATS_DEBUG) {
+        uint32_t val = 0;
+        if (!base::ParseUint(value, &val)) {
+            LOG_TO(SYSTEM, ERROR) << "Invalid value: " << value;
+            return;
+        }
+        if (key == WAKEUPSTATS_TOPCOUNT) {
+            mTopCount = val;
+            LOG_TO(SYSTEM, INFO) << "set top count " << mTopCount;
+        } else if (key == WAKEUPSTATS_DISABLED) {
+            mDisabled = (val != 0);
+            LOG_TO(SYSTEM, INFO) << "set disabled " << mDisabled;
+        } else {
+            cDebug = (val != 0);
+            LOG_TO(SYSTEM, INFO) << "set debug " << cDebug;
+        }
+    }
+}
+
+// Index /sys/class/wakeup; sources already known keep their fds and samples
+void WakeupStats::scanSources(void) {
+    DIR *dir = opendir(WAKEUP_CLASS_DIR);
+    if (dir == NULL) {
+        LOG_TO(SYSTEM, WARNING) << "Fail to open " << WAKEUP_CLASS_DIR;
+        return;
+    }
+    for (auto &entry : mSources) entry.second.present = false;
+    struct dirent *ent;
+    while ((ent = readdir(dir)) != NULL) {
+        std::string_view dirName = ent->d_name;
+        if (dirName == "." || dirName == "..") {
+            continue;
+        }
+        auto it = mSources.find(dirName);
+        if (it != mSources.end()) {
+            it->second.present = true;
+            continue;
+        }
+        std::string base = WAKEUP_CLASS_DIR + std::string(dirName) + "/";
+        WakeupSource source;
+        if (!android::base::ReadFileToString(base + "name", &source.name)) {
+            continue;
+        }
+        source.name = android::base::Trim(source.name);
+        for (int i = 0; i < WAKEUP_COUNTER_MAX; i++) {
+            std::string path = base + WAKEUP_NODES[i];
+            source.fds[i].reset(TEMP_FAILURE_RETRY(open(path.c_str(), O_RDONLY | O_CLOEXEC)));
+        }
+        source.valid = false;
+        source.present = true;
+        mSources.emplace(dirName, std::move(source));
+    }
+    closedir(dir);
+    for (auto it = mSources.begin(); it != mSources.end();) {
+        if (!it->second.present)
+            it = mSources.erase(it);
+        else
+            ++it;
+    }
+    mTicks = 0;
+}
+
+void WakeupStats::readSysfs(void) {
+    if (++mTicks >= WAKEUP_RESCAN_TICKS) {
+        scanSources();
+    }
+    for (auto &entry : mSources) {
+        WakeupSource &source = entry.second;
+        source.present = true;
+        for (int i = 0; i < WAKEUP_COUNTER_MAX; i++) {
+            if (source.fds[i] < 0 || !readFdToBuffer(source.fds[i], &mBuffer) ||
+                !TextScanner(mBuffer).parseUint(&source.curr[i])) {
+                // Unregistered since the last scan
+                source.present = false;
+                break;
+            }
+        }
+    }
+}
+
+/*
+ * Parse the debugfs table, e.g.
+ * name            active_count event_count wakeup_count expire_count active_since total_time ...
+ * PowerManager.SuspendLockout  0   0   0   0   0   0   0   29871   0
+ */
+void WakeupStats::parseDebugfs(std::string_view text,
+                               std::map<std::string, WakeupSource, std::less<>> *sources) {
+    for (auto &entry : *sources) entry.second.present = false;
+    TextScanner scanner(text);
+    scanner.nextLine();  // header
+    for (; !scanner.atEnd(); scanner.nextLine()) {
+        std::string_view name;
+        uint64_t col[6];
+        if (!scanner.token(&name))
+            continue;
+        bool ok = true;
+        for (int i = 0; i < 6 && ok; i++) ok = scanner.parseUint(&col[i]);
+        if (!ok)
+            continue;
+        auto it = sources->find(name);
+        if (it == sources->end()) {
+            WakeupSource source;
+            source.name = std::string(name);
+            source.valid = false;
+            it = sources->emplace(source.name, std::move(source)).first;
+        }
+        WakeupSource &source = it->second;
+        source.present = true;
+        source.curr[WAKEUP_EVENT_COUNT] = col[1];
+        source.curr[WAKEUP_TOTAL_TIME] = col[5];
+    }
+    for (auto it = sources->begin(); it != sources->end();) {
+        if (!it->second.present)
+            it = sources->erase(it);
+        else
+            ++it;
+    }
+}
+
+void WakeupStats::readDebugfs(void) {
+    if (!readFileToBuffer(WAKEUP_DEBUGFS_PATH, &mBuffer)) {
+        if (cDebug)
+            PLOG_TO(SYSTEM, WARNING) << "Fail to read " << WAKEUP_DEBUGFS_PATH;
+        return;
+    }
+    parseDebugfs(mBuffer, &mSources);
+}
+
+bool WakeupStats::readSuspend(uint64_t *counters) {
+    bool sysfs = true;
+    for (int i = 0; i < SUSPEND_COUNTER_MAX && sysfs; i++) {
+        sysfs = mSuspendFds[i] >= 0 && readFdToBuffer(mSuspendFds[i], &mBuffer) &&
+                TextScanner(mBuffer).parseUint(&counters[i]);
+    }
+    if (sysfs)
+        return true;
+    // Older kernels only have the debugfs summary, e.g. "success: 12\nfail: 0\n..."
+    if (!readFileToBuffer(SUSPEND_DEBUGFS_PATH, &mBuffer))
+        return false;
+    int found = 0;
+    TextScanner scanner(mBuffer);
+    for (; !scanner.atEnd(); scanner.nextLine()) {
+        if (scanner.consume("success:") && scanner.parseUint(&counters[SUSPEND_SUCCESS])) {
+            found++;
+        } else if (scanner.consume("fail:") && scanner.parseUint(&counters[SUSPEND_FAIL])) {
+            found++;
+        }
+    }
+    return found == SUSPEND_COUNTER_MAX;
+}
+
+/* Dump suspend attempts and the wakeup sources held longest (Sample Log)
+ *
+ * [WAKEUP: 10.001s] suspend success:2 fail:1 sources:312
+ * [WAKEUP_TOP1] PowerManagerService.WakeLocks held:4.210s events:17
+ * [WAKEUP_TOP2] qcom_rx_wakelock held:0.520s events:40
+ */
+void WakeupStats::refresh(void) {
+    if (mDisabled)
+        return;
+
+    std::chrono::system_clock::time_point now = std::chrono::system_clock::now();
+    std::chrono::steady_clock::time_point awake = std::chrono::steady_clock::now();
+    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(awake - mLast);
+    mLast = awake;
+
+    uint64_t suspend[SUSPEND_COUNTER_MAX];
+    uint64_t suspendDiff[SUSPEND_COUNTER_MAX] = {};
+    bool suspendValid = false;
+    if (readSuspend(suspend)) {
+        suspendValid = mSuspendValid;
+        for (int i = 0; i < SUSPEND_COUNTER_MAX; i++) {
+            suspendDiff[i] = suspend[i] - mSuspendPrev[i];
+            mSuspendPrev[i] = suspend[i];
+        }
+        mSuspendValid = true;
+    } else {
+        mSuspendValid = false;
+    }
+
+    if (mUseSysfs) {
+        readSysfs();
+    } else {
+        readDebugfs();
+    }
+    mTop.clear();
+    for (auto &entry : mSources) {
+        WakeupSource &source = entry.second;
+        if (!source.present) {
+            source.valid = false;
+            continue;
+        }
+        if (source.valid) {
+            // total_time already counts the active period in progress
+            uint64_t held = source.curr[WAKEUP_TOTAL_TIME];
+            uint64_t prevHeld = source.prev[WAKEUP_TOTAL_TIME];
+            if (held > prevHeld) {
+                mTop.push_back({held - prevHeld,
+                                source.curr[WAKEUP_EVENT_COUNT] - source.prev[WAKEUP_EVENT_COUNT],
+                                &source});
+            }
+        }
+        std::copy(source.curr, source.curr + WAKEUP_COUNTER_MAX, source.prev);
+        source.valid = true;
+    }
+    if (!suspendValid && mTop.empty())
+        return;
+
+    std::string out = android::base::StringPrintf(
+        FMT_WAKEUP, ms.count() / 1000, ms.count() % 1000, suspendDiff[SUSPEND_SUCCESS],
+        suspendDiff[SUSPEND_FAIL], mSources.size());
+    size_t count = std::min<size_t>(mTopCount, mTop.size());
+    std::partial_sort(
+        mTop.begin(), mTop.begin() + count, mTop.end(),
+        [](const WakeupDelta &a, const WakeupDelta &b) { return a.heldMs > b.heldMs; });
+    for (size_t i = 0; i < count; i++) {
+        const WakeupDelta &top = mTop[i];
+        out.append(android::base::StringPrintf(FMT_WAKEUP_TOP, i + 1, top.source->name.c_str(),
+                                               top.heldMs / 1000, top.heldMs % 1000, top.events));
+    }
+    if (cDebug)
+        LOG_TO(SYSTEM, INFO) << out;
+    append(now, out);
+}
@@ -17,9 +17,12 @@
 #ifndef __SENSORS_H__
 #define __SENSORS_H__
 
+#include <mutex>
 #include <string>
 #include <unordered_map>
 
+#include <android-base/unique_fd.h>
+
 namespace android {
 namespace hardware {
 namespace google {
@@ -43,10 +46,30 @@ class Sensors {
      bool readSensorFile(
          const std::string& sensor_name, std::string* data,
          std::string* file_path) const;
+     // Reads the sensor and parses it as an integer, in millidegrees for
+     // temperature sensors. Returns false if the sensor is not found or the
+     // file does not hold an integer.
+     bool readSensorValue(const std::string& sensor_name, int* value) const;
      size_t getNumSensors() const { return sensor_names_to_path_map_.size(); }
 
     private:
-     std::unordered_map<std::string, std::string> sensor_names_to_path_map_;
+     // The sensor file is kept open and re-read with pread(); it is reopened
+     // when a read fails, e.g. after the driver re-registered the sensor.
+     // Sensors are read from the polling thread and from binder threads, so
+     // each file has its own lock and reads of different sensors don't wait
+     // on each other.
+     struct SensorFile {
+         std::string path;
+         mutable android::base::unique_fd fd;
+         mutable std::mutex fd_mutex;
+     };
+
+     // Fills buf with the sensor contents, NUL terminated. Returns the
+     // length read, or -1 on failure. Requires sensor.fd_mutex.
+     ssize_t readSensor(const SensorFile& sensor, char* buf,
+                        size_t size) const;
+
+     std::unordered_map<std::string, SensorFile> sensor_names_to_path_map_;
 };
 
 }  // namespace thermal
@@ -14,10 +14,14 @@
  * limitations under the License.
  */
 
+#include <fcntl.h>
+#include <unistd.h>
+
 #include <algorithm>
+#include <cctype>
+#include <charconv>
 
-#include <android-base/file.h>
-#include <android-base/strings.h>
+#include <android-base/logging.h>
 #include "include/pixelthermal/sensors.h"
 
 namespace android {
@@ -26,38 +30,102 @@ namespace google {
 namespace pixel {
 namespace thermal {
 
+namespace {
+
+// Sensor files hold a single integer, e.g. "45000\n".
+constexpr size_t kSensorReadSize = 32;
+
+}  // namespace
+
 std::string Sensors::getSensorPath(const std::string& sensor_name) {
-    if (sensor_names_to_path_map_.find(sensor_name) !=
-            sensor_names_to_path_map_.end()) {
-        return sensor_names_to_path_map_.at(sensor_name);
+    auto sensor_itr = sensor_names_to_path_map_.find(sensor_name);
+    if (sensor_itr != sensor_names_to_path_map_.end()) {
+        return sensor_itr->second.path;
     }
     return "";
 }
 
 bool Sensors::addSensor(
         const std::string& sensor_name, const std::string& path) {
-    return sensor_names_to_path_map_.emplace(sensor_name, path).second;
+    // SensorFile holds a mutex, so it is built in place.
+    auto result = sensor_names_to_path_map_.try_emplace(sensor_name);
+    if (!result.second) {
+        return false;
+    }
+    SensorFile& sensor = result.first->second;
+    sensor.path = path;
+    sensor.fd.reset(TEMP_FAILURE_RETRY(
+        open(path.c_str(), O_RDONLY | O_CLOEXEC)));
+    return true;
+}
+
+ssize_t Sensors::readSensor(const SensorFile& sensor, char* buf,
+                            size_t size) const {
+    // Try the cached fd first, then reopen once.
+    for (int attempt = 0; attempt < 2; attempt++) {
+        if (sensor.fd < 0 || attempt > 0) {
+            sensor.fd.reset(TEMP_FAILURE_RETRY(
+                open(sensor.path.c_str(), O_RDONLY | O_CLOEXEC)));
+            if (sensor.fd < 0) {
+                break;
+            }
+        }
+        ssize_t len = TEMP_FAILURE_RETRY(pread(sensor.fd, buf, size - 1, 0));
+        if (len >= 0) {
+            buf[len] = '\0';
+            return len;
+        }
+    }
+    buf[0] = '\0';
+    return -1;
 }
 
 bool Sensors::readSensorFile(
         const std::string& sensor_name, std::string* data,
         std::string* file_path) const {
-    std::string sensor_reading;
-    if (sensor_names_to_path_map_.find(sensor_name) ==
-            sensor_names_to_path_map_.end()) {
+    auto sensor_itr = sensor_names_to_path_map_.find(sensor_name);
+    if (sensor_itr == sensor_names_to_path_map_.end()) {
         *data = "";
         *file_path = "";
         return false;
     }
 
-    android::base::ReadFileToString(
-        sensor_names_to_path_map_.at(sensor_name), &sensor_reading);
+    char buf[kSensorReadSize];
+    ssize_t len;
+    {
+        std::lock_guard<std::mutex> lock(sensor_itr->second.fd_mutex);
+        len = readSensor(sensor_itr->second, buf, sizeof(buf));
+    }
     // Strip the newline.
-    *data = ::android::base::Trim(sensor_reading);
-    *file_path = sensor_names_to_path_map_.at(sensor_name);
+    while (len > 0 && std::isspace(static_cast<unsigned char>(buf[len - 1]))) {
+        len--;
+    }
+    data->assign(buf, std::max<ssize_t>(len, 0));
+    *file_path = sensor_itr->second.path;
     return true;
 }
 
+bool Sensors::readSensorValue(
+        const std::string& sensor_name, int* value) const {
+    auto sensor_itr = sensor_names_to_path_map_.find(sensor_name);
+    if (sensor_itr == sensor_names_to_path_map_.end()) {
+        return false;
+    }
+
+    char buf[kSensorReadSize];
+    ssize_t len;
+    {
+        std::lock_guard<std::mutex> lock(sensor_itr->second.fd_mutex);
+        len = readSensor(sensor_itr->second, buf, sizeof(buf));
+    }
+    if (len <= 0) {
+        LOG(ERROR) << "Could not read " << sensor_itr->second.path;
+        return false;
+    }
+    auto result = std::from_chars(buf, buf + len, *value);
+    return result.ec == std::errc();
+}
+
 }  // namespace thermal
 }  // namespace pixel
 }  // namespace google